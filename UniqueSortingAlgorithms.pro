@@ -3,7 +3,7 @@ QT -= gui
 TEMPLATE = lib
 DEFINES += UNIQUESORTINGALGORITHMS_LIBRARY
 
-CONFIG += c++11
+CONFIG += c++11 thread
 
 # The following define makes your compiler emit warnings if you use
 # any Qt feature that has been marked deprecated (the exact warnings
@@ -22,7 +22,11 @@ HEADERS += \
     binaryquicksort.h \
     cartesiantreesort.h \
     introsort.h \
-    smoothsort.h
+    lsdradixsort.h \
+    simdpartition.h \
+    smallsort.h \
+    smoothsort.h \
+    workstealingpool.h
 
 # Default rules for deployment.
 unix {
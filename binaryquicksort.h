@@ -9,9 +9,13 @@
 #define BINARYQUICKSORT_H
 
 #include <climits>   // For CHAR_BIT
+#include <cstdint>   // For uint32_t, uint64_t
+#include <cstring>   // For std::memcpy
 #include <iterator>
 #include <limits>
-#include <algorithm> // For std::iter_swap, std::rotate, std::find_if
+#include <algorithm> // For std::iter_swap
+#include <type_traits> // For std::make_unsigned, std::decay
+#include <utility>   // For std::move, std::swap
 
 /**
  * Function: BinaryQuicksort(RandomIterator begin, RandomIterator end);
@@ -19,34 +23,212 @@
  * ------------------------------------------------------------------------
  * Applies the binary quicksort algorithm to sort the specified list of
  * numbers.  It is assumes that the iterators are traversing a list of
- * integral types, and will not function properly otherwise.
+ * integral types or of IEEE-754 floats or doubles, and will not function
+ * properly otherwise.  Floating-point values are sorted by the IEEE-754
+ * total order: -0.0 comes just before +0.0, and NaNs end up at the front
+ * or back of the range depending on their sign bit.
  */
 template <typename RandomIterator>
 void BinaryQuicksort(RandomIterator begin, RandomIterator end);
 
+/**
+ * Function: BinaryQuicksort(RandomIterator begin, RandomIterator end,
+ *                           KeyFunction keyFn);
+ * Usage: BinaryQuicksort(v.begin(), v.end(), GetTimestamp());
+ * ------------------------------------------------------------------------
+ * Applies the binary quicksort algorithm to sort the specified list of
+ * records by the key that keyFn extracts from each of them.  The keys must
+ * be of a type that BinaryQuicksort can sort directly, and the records are
+ * moved around as a whole.
+ */
+template <typename RandomIterator, typename KeyFunction>
+void BinaryQuicksort(RandomIterator begin, RandomIterator end,
+                     KeyFunction keyFn);
+
+/**
+ * Function: BinaryQuicksortIndirect(RandomIterator begin, RandomIterator end,
+ *                                   KeyFunction keyFn);
+ * Usage: BinaryQuicksortIndirect(v.begin(), v.end(), GetTimestamp());
+ * ------------------------------------------------------------------------
+ * Sorts the specified list of records by the key that keyFn extracts from
+ * each of them, like the three-argument BinaryQuicksort.  Rather than moving
+ * the records on every partitioning step, this version sorts a compact array
+ * of (key, index) pairs and then moves each record exactly once, into its
+ * final position.  This is faster when the records are much larger than
+ * their keys, at the cost of O(n) auxiliary memory.
+ */
+template <typename RandomIterator, typename KeyFunction>
+void BinaryQuicksortIndirect(RandomIterator begin, RandomIterator end,
+                             KeyFunction keyFn);
+
+/**
+ * Function: ParallelBinaryQuicksort(RandomIterator begin, RandomIterator end,
+ *                                   Executor& executor);
+ * Usage: WorkStealingPool pool;
+ *        ParallelBinaryQuicksort(v.begin(), v.end(), pool);
+ * ------------------------------------------------------------------------
+ * Applies the binary quicksort algorithm to sort the specified list of
+ * numbers, using the executor (typically a WorkStealingPool) to spread the
+ * work across cores.  The partitioning step on the most significant bit is
+ * itself done in parallel: each thread partitions its own chunk of the
+ * range, and then the misplaced elements are exchanged across chunks in
+ * parallel.  The two resulting halves, and the subranges they split into,
+ * are then sorted as independent tasks.  As with BinaryQuicksort, the
+ * values must be of an integral type or IEEE-754 floats or doubles.
+ */
+template <typename RandomIterator, typename Executor>
+void ParallelBinaryQuicksort(RandomIterator begin, RandomIterator end,
+                             Executor& executor);
+
+/**
+ * Function: ParallelBinaryQuicksort(RandomIterator begin, RandomIterator end,
+ *                                   KeyFunction keyFn, Executor& executor);
+ * Usage: ParallelBinaryQuicksort(v.begin(), v.end(), GetTimestamp(), pool);
+ * ------------------------------------------------------------------------
+ * Sorts the specified list of records by the key that keyFn extracts from
+ * each of them, in parallel as described above.
+ */
+template <typename RandomIterator, typename KeyFunction, typename Executor>
+void ParallelBinaryQuicksort(RandomIterator begin, RandomIterator end,
+                             KeyFunction keyFn, Executor& executor);
+
 /* * * * * Implementation Below This Point * * * * */
+#include <cstddef>   // For size_t
+#include <vector>
+#include "simdpartition.h"
+#include "workstealingpool.h"
+
+/* Keeps a function out of line, so that its locals don't take up space in
+ * the frames of the functions that call it.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define BINARYQUICKSORT_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BINARYQUICKSORT_NOINLINE __declspec(noinline)
+#else
+#define BINARYQUICKSORT_NOINLINE
+#endif
 
 namespace binaryquicksort_detail {
 
+  /* A traits type describing how values of type T are turned into unsigned
+   * integer keys whose ordering as unsigned numbers matches the ordering of
+   * the original values.  All of the bitwise partitioning below works on
+   * these keys rather than on the values themselves.
+   *
+   * For unsigned types the key is just the value.  For signed two's-
+   * complement types, the sign bit is set on negative values and clear on
+   * nonnegative ones, so negative values would sort after nonnegative ones
+   * if treated as unsigned.  Flipping the sign bit fixes this: afterwards it
+   * is clear on negative values and set on nonnegative ones, which maps the
+   * smallest value to zero and the largest to all ones while leaving every
+   * other bit, and hence the relative order within each sign, unchanged.
+   * Because this happens as the keys are read, signed values need no extra
+   * pass over the data.
+   */
+  template <typename T> struct RadixTraits {
+    /* The unsigned type holding the key. */
+    typedef typename std::make_unsigned<T>::type KeyType;
+
+    /* The bit that is flipped in the key: the sign bit for signed types,
+     * and nothing for unsigned ones.
+     */
+    static KeyType SignFlip() {
+      return std::numeric_limits<T>::is_signed?
+        KeyType(KeyType(1) << (CHAR_BIT * sizeof(T) - 1)) : KeyType(0);
+    }
+
+    /* Returns the key for a value. */
+    static KeyType ToKey(const T& value) {
+      return KeyType(KeyType(value) ^ SignFlip());
+    }
+  };
+
+  /* A traits type for IEEE-754 floating-point types, whose keys are unsigned
+   * integers of the same width holding the raw bits.  As with signed
+   * integers, the sign bit is set on negative values and must be flipped.
+   * Unlike two's complement, though, the remaining bits of a negative value
+   * hold its magnitude, so larger bit patterns are more negative.  Negative
+   * values therefore have all of their bits flipped instead, which both
+   * clears the sign bit and reverses their order.  The result is the IEEE-754
+   * total order: -0.0 sorts just before +0.0, and NaNs sort below -infinity
+   * or above +infinity according to their sign bit.
+   */
+  template <typename T, typename Bits> struct FloatRadixTraits {
+    /* This only works on IEEE-754 values.  The check lives here so that it
+     * is made only by programs that sort floating-point keys.
+     */
+    static_assert(std::numeric_limits<T>::is_iec559 &&
+                  sizeof(T) == sizeof(Bits),
+                  "BinaryQuicksort requires IEEE-754 float and double");
+
+    /* The unsigned type holding the key. */
+    typedef Bits KeyType;
+
+    /* Returns the key for a value.  The mask is all ones for negative values
+     * and just the sign bit otherwise, computed without branching.
+     */
+    static KeyType ToKey(const T& value) {
+      const signed int kSignBit = signed(CHAR_BIT * sizeof(KeyType)) - 1;
+
+      KeyType bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+
+      const KeyType mask = KeyType(KeyType(0) - (bits >> kSignBit)) |
+                           KeyType(KeyType(1) << kSignBit);
+      return KeyType(bits ^ mask);
+    }
+  };
+
+  template <> struct RadixTraits<float>  : FloatRadixTraits<float,  uint32_t> {};
+  template <> struct RadixTraits<double> : FloatRadixTraits<double, uint64_t> {};
+
+  /* Utility function that returns the order-preserving key for a value. */
+  template <typename T>
+  typename RadixTraits<T>::KeyType RadixKey(const T& value) {
+    return RadixTraits<T>::ToKey(value);
+  }
+
+  /* The default key function, which uses each value as its own key. */
+  struct IdentityKey {
+    template <typename T>
+    const T& operator() (const T& value) const {
+      return value;
+    }
+  };
+
+  /* A traits type naming the type of the keys that KeyFunction extracts from
+   * the elements of a range, and the type of the radix keys they map to.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  struct ProjectionTraits {
+    typedef typename std::decay<
+      decltype(std::declval<KeyFunction&>()(*std::declval<RandomIterator&>()))
+    >::type ValueType;
+    typedef typename RadixTraits<ValueType>::KeyType KeyType;
+  };
+
   /* Utility function to partition the elements of a range by moving all
    * elements in the range having a 0 in a given position to the right and all
    * elements in the range having a 1 in a given position to the left.  The
    * function then returns an iterator to the beginning of the range that
-   * contains a 1.
+   * contains a 1.  Bits are read from the radix key (see RadixTraits) of the
+   * key that keyFn extracts from each element.
    *
    * This algorithm works by having begin point one step past the end of the
    * range of values known to be 0 and end point at the range of values known
    * to be 1.  The endpoints are then marched inward until they collide (in
    * which case we're done) or a pair of mismatched elements are found.
    */
-  template <typename RandomIterator>
+  template <typename RandomIterator, typename KeyFunction>
   RandomIterator PartitionAtBit(RandomIterator begin, RandomIterator end,
-                                signed int bit) {
-    /* Typedef defining the type of the elements being traversed. */
-    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+                                signed int bit, KeyFunction keyFn,
+                                std::false_type) {
+    /* Typedef defining the type of the keys being partitioned. */
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType KeyType;
 
     /* Compute the bitmask we'll use to test whether the bit is set. */
-    const T bitmask = T(1) << bit;
+    const KeyType bitmask = KeyType(KeyType(1) << bit);
 
     /* Move these two together until they meet or we find two elements that
      * are out of place.
@@ -55,7 +237,7 @@ namespace binaryquicksort_detail {
       /* Find the first 1 after the 0s; it's either the end or we've just
        * found the element that's out of place.
        */
-      while (begin < end && !(*begin & bitmask))
+      while (begin < end && !(RadixKey(keyFn(*begin)) & bitmask))
         ++ begin;
 
       /* If the begin is now sitting atop the end, we're done and all of the
@@ -73,7 +255,7 @@ namespace binaryquicksort_detail {
        */
       do {
         --end;
-      } while (begin < end && !!(*end & bitmask));
+      } while (begin < end && !!(RadixKey(keyFn(*end)) & bitmask));
 
       /* If the two are equal, we've found the crossover point and are done.
        * We can hand back this element as the pivot point.
@@ -86,15 +268,268 @@ namespace binaryquicksort_detail {
     }
   }
 
-  /* Utility function which actually performs the binary quicksort algorithm,
-   * beginning with the specified bit.
+  /* The predicate used to partition arrays of keys at a bit with the vector
+   * kernel from simdpartition.h.  Values whose radix key has a 0 in the bit
+   * go to the front.  The vector version builds the radix keys of a whole
+   * vector of values at once, exactly as RadixTraits does one at a time:
+   * signed integers have their sign bits flipped, and floats and doubles
+   * have their sign bits flipped if they are nonnegative and all of their
+   * bits flipped otherwise.
    */
-  template <typename RandomIterator>
-  void BinaryQuicksortAtBit(RandomIterator begin, RandomIterator end,
-                            signed int bit) {
+  template <typename T>
+  struct BitIsZero {
+    typedef typename RadixTraits<T>::KeyType KeyType;
+    KeyType bitmask;
+
+    bool operator()(const T& value) const {
+      return !(RadixKey(value) & bitmask);
+    }
+
+#if SIMDPARTITION_HAS_AVX2
+    SIMDPARTITION_TARGET_AVX2 __m256i Setup() const {
+      return sizeof(T) == 4? _mm256_set1_epi32(int32_t(bitmask)) :
+                             _mm256_set1_epi64x((long long)(bitmask));
+    }
+
+    SIMDPARTITION_TARGET_AVX2 unsigned Mask(__m256i values, __m256i bitmasks) const {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i signBits = sizeof(T) == 4?
+        _mm256_set1_epi32(int32_t(0x80000000u)) :
+        _mm256_set1_epi64x((long long)(uint64_t(1) << 63));
+
+      /* Work out which bits of each value to flip to get its key. */
+      __m256i flip = zero;
+      if (std::is_floating_point<T>::value) {
+        const __m256i negative = sizeof(T) == 4? _mm256_srai_epi32(values, 31) :
+                                                 _mm256_cmpgt_epi64(zero, values);
+        flip = _mm256_or_si256(negative, signBits);
+      } else if (std::numeric_limits<T>::is_signed) {
+        flip = signBits;
+      }
+
+      const __m256i bits =
+        _mm256_and_si256(_mm256_xor_si256(values, flip), bitmasks);
+      return sizeof(T) == 4?
+        unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, zero)))) :
+        unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(bits, zero))));
+    }
+#endif
+  };
+
+  /* A type trait that determines whether PartitionAtBit can use the vector
+   * kernel.  This needs a contiguous array of values that are their own keys
+   * and that are 32- or 64-bit integers, floats, or doubles.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  struct IsSimdBitPartitionable {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+    static const bool value =
+      simdpartition_detail::IsContiguousIterator<RandomIterator>::value &&
+      std::is_same<KeyFunction, IdentityKey>::value &&
+      simdpartition_detail::KeyKindOf<T>::value != simdpartition_detail::kUnsupportedKey;
+  };
+
+  /* Utility function to partition the elements of a range at a bit, exactly
+   * like the version above, for contiguous arrays of primitive values.  When
+   * the processor supports AVX2, this tests a whole vector of values at once
+   * and splits it with a single shuffle (see simdpartition.h), so it never
+   * branches on the data.  Otherwise, it falls back on the version above.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  RandomIterator PartitionAtBit(RandomIterator begin, RandomIterator end,
+                                signed int bit, KeyFunction keyFn,
+                                std::true_type) {
     /* Typedef defining the type of the elements being traversed. */
     typedef typename std::iterator_traits<RandomIterator>::value_type T;
 
+#if SIMDPARTITION_HAS_AVX2
+    if (SimdPartitionSupported() && begin != end) {
+      const BitIsZero<T> pred = {
+        typename BitIsZero<T>::KeyType(typename BitIsZero<T>::KeyType(1) << bit)
+      };
+      T* first = &*begin;
+      return begin + (simdpartition_detail::Avx2PartitionBy(first, first + (end - begin), pred) - first);
+    }
+#endif
+    return PartitionAtBit(begin, end, bit, keyFn, std::false_type());
+  }
+
+  /* Utility function to partition the elements of a range at a bit, choosing
+   * the vector kernel where it applies.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  RandomIterator PartitionAtBit(RandomIterator begin, RandomIterator end,
+                                signed int bit, KeyFunction keyFn) {
+    return PartitionAtBit(begin, end, bit, keyFn,
+                          std::integral_constant<bool,
+                            IsSimdBitPartitionable<RandomIterator, KeyFunction>::value>());
+  }
+
+  /* Constants controlling when BinaryQuicksortAtBit switches strategies.
+   * Ranges at least kByteRadixCutoff long are split eight bits at a time,
+   * since a byte-wide pass costs about as much as a single-bit one but does
+   * eight times the work.  Below that, the 256 counters of a byte-wide pass
+   * dominate and we go back to one bit at a time.  Ranges shorter than
+   * kInsertionSortCutoff are finished off with insertion sort.
+   */
+  const size_t kByteRadixCutoff     = 1024;
+  const size_t kInsertionSortCutoff = 16;
+
+  /* The number of buckets used by a byte-wide pass. */
+  const size_t kNumByteBuckets = 1 << CHAR_BIT;
+
+  /* Utility function returning the value of the CHAR_BIT bits of the radix
+   * key of value whose lowest bit is lowBit.
+   */
+  template <typename T>
+  size_t DigitAt(const T& value, signed int lowBit) {
+    return size_t(RadixKey(value) >> lowBit) & (kNumByteBuckets - 1);
+  }
+
+  /* Utility function to partition the elements of a range by the CHAR_BIT
+   * bits whose lowest bit is lowBit, in the style of American flag sort.  On
+   * return, bucket i of the range spans [begin + bucketStarts[i],
+   * begin + bucketStarts[i + 1]).
+   *
+   * The algorithm first counts how many elements belong in each bucket, which
+   * tells us where each bucket begins and ends.  It then walks each bucket in
+   * turn.  Whenever it finds an element that belongs elsewhere, it picks the
+   * element up and drops it in the next open slot of its home bucket, picks
+   * up whatever was displaced from there, and repeats until it is holding an
+   * element that belongs in the slot it started from.  When dropping an
+   * element off, we first skip over any slots in its bucket that already
+   * hold elements belonging there, so every element is moved at most once
+   * to reach its home bucket.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  void PartitionAtByte(RandomIterator begin, RandomIterator end,
+                       signed int lowBit,
+                       size_t bucketStarts[kNumByteBuckets + 1],
+                       KeyFunction keyFn) {
+    /* Typedef defining the type of the elements being traversed. */
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Count how many elements fall into each bucket. */
+    size_t counts[kNumByteBuckets] = {};
+    for (RandomIterator itr = begin; itr != end; ++itr)
+      ++counts[DigitAt(keyFn(*itr), lowBit)];
+
+    /* Convert the counts into the starting position of each bucket.  The next
+     * open slot of each bucket starts off at its beginning.
+     */
+    size_t nextSlot[kNumByteBuckets];
+    bucketStarts[0] = 0;
+    for (size_t i = 0; i < kNumByteBuckets; ++i) {
+      nextSlot[i] = bucketStarts[i];
+      bucketStarts[i + 1] = bucketStarts[i] + counts[i];
+    }
+
+    /* Place every element into its home bucket, one bucket at a time.  By the
+     * time we reach the last bucket, everything in it already belongs there.
+     */
+    for (size_t bucket = 0; bucket + 1 < kNumByteBuckets; ++bucket) {
+      while (nextSlot[bucket] < bucketStarts[bucket + 1]) {
+        RandomIterator slot = begin + nextSlot[bucket];
+        size_t digit = DigitAt(keyFn(*slot), lowBit);
+
+        /* If this element is already home, just skip over it. */
+        if (digit == bucket) {
+          ++nextSlot[bucket];
+          continue;
+        }
+
+        /* Otherwise, follow the cycle of displaced elements until we pick up
+         * one that belongs in this slot.
+         */
+        T value = std::move(*slot);
+        do {
+          while (DigitAt(keyFn(*(begin + nextSlot[digit])), lowBit) == digit)
+            ++nextSlot[digit];
+
+          using std::swap;
+          swap(value, *(begin + nextSlot[digit]++));
+          digit = DigitAt(keyFn(value), lowBit);
+        } while (digit != bucket);
+
+        *slot = std::move(value);
+        ++nextSlot[bucket];
+      }
+    }
+  }
+
+  /* Utility function which sorts a small range with insertion sort.  The
+   * values are compared by their keys so that they come out in the same
+   * order that the bitwise partitioning steps would put them in.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  void InsertionSortBits(RandomIterator begin, RandomIterator end,
+                         KeyFunction keyFn) {
+    /* Typedef defining the type of the elements being traversed. */
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    if (begin == end) return;
+
+    for (RandomIterator itr = begin + 1; itr != end; ++itr) {
+      /* Shift larger elements up until we find the hole for this one. */
+      T value = std::move(*itr);
+      const typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType
+        key = RadixKey(keyFn(value));
+
+      RandomIterator hole = itr;
+      for (; hole != begin && key < RadixKey(keyFn(*(hole - 1))); --hole)
+        *hole = std::move(*(hole - 1));
+      *hole = std::move(value);
+    }
+  }
+
+  /* Utility function that returns a mask of the key bits that are not the
+   * same across every value in the range.  A bit is constant exactly when
+   * the OR and the AND of all the keys agree on it.  The loop carries no
+   * dependencies other than the two reductions, so compilers can vectorize
+   * it over contiguous ranges.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType
+  VaryingBits(RandomIterator begin, RandomIterator end, KeyFunction keyFn) {
+    /* Typedef defining the type of the keys being examined. */
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType KeyType;
+
+    KeyType orBits = 0, andBits = KeyType(~KeyType(0));
+    for (; begin != end; ++begin) {
+      const KeyType key = RadixKey(keyFn(*begin));
+      orBits  |= key;
+      andBits &= key;
+    }
+    return KeyType(orBits ^ andBits);
+  }
+
+  /* Utility function that returns the index of the highest set bit in mask
+   * that is no higher than bit, or -1 if there is no such bit.
+   */
+  template <typename KeyType>
+  signed int HighestSetBit(KeyType mask, signed int bit) {
+    while (bit >= 0 && !((mask >> bit) & 1))
+      --bit;
+    return bit;
+  }
+
+  /* Forward declaration of the byte-wide step used by BinaryQuicksortAtBit. */
+  template <typename RandomIterator, typename KeyFunction>
+  void SortByteBuckets(RandomIterator& begin, RandomIterator& end,
+                       signed int bit,
+                       typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType varying,
+                       KeyFunction keyFn);
+
+  /* Utility function which actually performs the binary quicksort algorithm,
+   * beginning with the specified bit.  The varying mask has a 1 in every bit
+   * that might differ between keys in the range; bits that were constant
+   * across some enclosing range are clear, and we never partition on them.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  void BinaryQuicksortAtBit(RandomIterator begin, RandomIterator end,
+                            signed int bit,
+                            typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType varying,
+                            KeyFunction keyFn) {
     /* Borrowing an optimization technique from quicksort, we will have this
      * function work iteratively and recursively.  To avoid having a large
      * number of function calls made, we will iteratively process the larger
@@ -105,10 +540,38 @@ namespace binaryquicksort_detail {
      * element in it, we're done.
      */
     while (bit >= 0 && std::distance(begin, end) > 1) {
+      const size_t numElems = size_t(std::distance(begin, end));
+
+      /* Small ranges are cheapest to finish off with insertion sort. */
+      if (numElems < kInsertionSortCutoff) {
+        InsertionSortBits(begin, end, keyFn);
+        return;
+      }
+
+      /* Large ranges with at least a byte's worth of bits left are split
+       * into 256 buckets at once.  Every bucket but the largest is sorted
+       * recursively, and we keep processing the largest one here.
+       */
+      if (numElems >= kByteRadixCutoff && bit + 1 >= CHAR_BIT) {
+        SortByteBuckets(begin, end, bit, varying, keyFn);
+        bit -= CHAR_BIT;
+
+        /* If every value landed in the same bucket, the byte was constant
+         * across the range, and the next few bits may well be too.  Rather
+         * than spending a pass on each of them, rescan the range to find the
+         * bits that actually vary.
+         */
+        if (size_t(end - begin) == numElems) {
+          varying = VaryingBits(begin, end, keyFn);
+          bit = HighestSetBit(varying, bit);
+        }
+        continue;
+      }
+
       /* Apply the partitioning step on this bit and get the start of the
        * range of values containing the 1s.
        */
-      RandomIterator pivot = PartitionAtBit(begin, end, bit);
+      RandomIterator pivot = PartitionAtBit(begin, end, bit, keyFn);
 
       /* Drop the index of the bit we're processing; this will cause the next
        * loop iteration to use the right bit and will make the recursive calls
@@ -116,6 +579,16 @@ namespace binaryquicksort_detail {
        */
       --bit;
 
+      /* If the bit was the same for every value, move on to the next bit
+       * that might vary.  We don't rescan the range here: a single bit's
+       * partition is cheap enough that a full pass to find the next varying
+       * bit would cost as much as it saves.
+       */
+      if (pivot == begin || pivot == end) {
+        bit = HighestSetBit(varying, bit);
+        continue;
+      }
+
       /* Determine which range is larger - the range holding the 0s or the
        * range holding the 1s.  Based on which is smaller, recursively process
        * one of the ranges.
@@ -124,61 +597,477 @@ namespace binaryquicksort_detail {
         /* There are fewer numbers beginning with 0; go recursively sort
          * them.
          */
-        BinaryQuicksortAtBit(begin, pivot, bit);
+        BinaryQuicksortAtBit(begin, pivot, bit, varying, keyFn);
         begin = pivot;
       } else {
         /* There are fewer numbers beginning with 1; go recursively sort
          * them.
          */
-        BinaryQuicksortAtBit(pivot, end, bit);
+        BinaryQuicksortAtBit(pivot, end, bit, varying, keyFn);
         end = pivot;
       }
     }
   }
 
-  /* If we are dealing with signed numbers, then negative numbers will
-   * incorrectly appear at the end of the range rather than the start, since
-   * the signed two's-complement representation will cause the sign bit to
-   * be set, making the negative values appear larger than positive values.
-   * This function applies a rotation to the final array to pull the negative
-   * values (if any) to the front.
+  /* Utility function which splits the range [begin, end) into buckets by the
+   * byte whose highest bit is bit, recursively sorts every bucket but the
+   * largest on the bits below it, and then narrows [begin, end) down to that
+   * largest bucket so that the caller can keep working on it.  This is kept
+   * out of line so that the table of bucket boundaries only takes up stack
+   * space while the byte is being split, rather than in every frame of the
+   * bit-by-bit recursion.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  BINARYQUICKSORT_NOINLINE
+  void SortByteBuckets(RandomIterator& begin, RandomIterator& end,
+                       signed int bit,
+                       typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType varying,
+                       KeyFunction keyFn) {
+    size_t bucketStarts[kNumByteBuckets + 1];
+    PartitionAtByte(begin, end, bit + 1 - CHAR_BIT, bucketStarts, keyFn);
+
+    size_t largest = 0;
+    for (size_t i = 1; i < kNumByteBuckets; ++i)
+      if (bucketStarts[i + 1] - bucketStarts[i] >
+          bucketStarts[largest + 1] - bucketStarts[largest])
+        largest = i;
+
+    for (size_t i = 0; i < kNumByteBuckets; ++i)
+      if (i != largest)
+        BinaryQuicksortAtBit(begin + bucketStarts[i],
+                             begin + bucketStarts[i + 1], bit - CHAR_BIT,
+                             varying, keyFn);
+
+    end   = begin + bucketStarts[largest + 1];
+    begin = begin + bucketStarts[largest];
+  }
+
+  /* Constant controlling the minimum size of a range that is worth splitting
+   * into parallel tasks.  Below this, the cost of queueing a task outweighs
+   * the work it saves.
+   */
+  const size_t kParallelCutoff = 1 << 14;
+
+  /* A run of positions [start, start + length), given as offsets from the
+   * beginning of the range being partitioned.
+   */
+  struct Interval {
+    size_t start, length;
+  };
+
+  /* Utility function that appends to the list the intersection of the
+   * ranges [start, end) and [lower, upper), if it is nonempty, and updates
+   * the running total of lengths.
+   */
+  inline void AppendIntersection(std::vector<Interval>& intervals,
+                                 std::vector<size_t>& totals,
+                                 size_t start, size_t end,
+                                 size_t lower, size_t upper) {
+    start = std::max(start, lower);
+    end   = std::min(end, upper);
+    if (start >= end) return;
+
+    Interval interval = { start, end - start };
+    intervals.push_back(interval);
+    totals.push_back(totals.back() + interval.length);
+  }
+
+  /* Utility function that finds which interval holds the index'th position
+   * (counting across all the intervals in order), storing the interval and
+   * the offset into it.
+   */
+  inline void LocateInInterval(const std::vector<size_t>& totals, size_t index,
+                               size_t& which, size_t& offset) {
+    which  = size_t(std::upper_bound(totals.begin(), totals.end(), index) -
+                    totals.begin()) - 1;
+    offset = index - totals[which];
+  }
+
+  /* A task that partitions one chunk of a range at the given bit, recording
+   * how many elements ended up on the 0 side of that chunk.
+   */
+  template <typename RandomIterator, typename KeyFunction>
+  struct PartitionChunkTask {
+    RandomIterator begin, end;
+    signed int bit;
+    KeyFunction keyFn;
+    size_t* numZeros;
+
+    void operator() () const {
+      *numZeros = size_t(PartitionAtBit(begin, end, bit, keyFn) - begin);
+    }
+  };
+
+  /* A task that exchanges the misplaced elements numbered [first, last), in
+   * the order given by the interval lists.  The lists hold the 1s that sit in
+   * the 0 region and the 0s that sit in the 1 region, and both have the same
+   * total length, so pairing them up in order fixes everything.
+   */
+  template <typename RandomIterator> struct SwapMisplacedTask {
+    RandomIterator begin;
+    const std::vector<Interval>* ones;
+    const std::vector<size_t>* oneTotals;
+    const std::vector<Interval>* zeros;
+    const std::vector<size_t>* zeroTotals;
+    size_t first, last;
+
+    void operator() () const {
+      if (first == last) return;
+
+      /* Find where we start in both lists. */
+      size_t oneIndex, oneOffset, zeroIndex, zeroOffset;
+      LocateInInterval(*oneTotals,  first, oneIndex,  oneOffset);
+      LocateInInterval(*zeroTotals, first, zeroIndex, zeroOffset);
+
+      /* March across both lists in lockstep, swapping as we go. */
+      for (size_t remaining = last - first; remaining != 0; --remaining) {
+        std::iter_swap(begin + ((*ones)[oneIndex].start + oneOffset),
+                       begin + ((*zeros)[zeroIndex].start + zeroOffset));
+
+        if (++oneOffset == (*ones)[oneIndex].length) {
+          ++oneIndex;
+          oneOffset = 0;
+        }
+        if (++zeroOffset == (*zeros)[zeroIndex].length) {
+          ++zeroIndex;
+          zeroOffset = 0;
+        }
+      }
+    }
+  };
+
+  /* Utility function that partitions the range at the given bit using all of
+   * the executor's threads, returning an iterator to the start of the 1s just
+   * as PartitionAtBit does.
+   *
+   * The range is cut into one chunk per thread, and each chunk is partitioned
+   * independently.  Summing the number of 0s in each chunk tells us where the
+   * boundary between the 0s and 1s belongs.  Every 1 to the left of that
+   * boundary must then be exchanged with some 0 to the right of it; these
+   * misplaced elements form a handful of runs, one per chunk, so we line the
+   * runs up and split the exchanges evenly among the threads.
+   */
+  template <typename RandomIterator, typename KeyFunction, typename Executor>
+  RandomIterator ParallelPartitionAtBit(RandomIterator begin,
+                                        RandomIterator end, signed int bit,
+                                        KeyFunction keyFn, Executor& executor) {
+    const size_t numElems  = size_t(end - begin);
+    const size_t numChunks = std::max<size_t>(executor.NumThreads(), 1);
+
+    /* Phase one: partition each chunk on its own. */
+    std::vector<size_t> chunkStarts(numChunks + 1);
+    std::vector<size_t> chunkZeros(numChunks);
+    for (size_t i = 0; i <= numChunks; ++i)
+      chunkStarts[i] = numElems / numChunks * i + std::min(i, numElems % numChunks);
+
+    {
+      TaskGroup<Executor> group(executor);
+      for (size_t i = 0; i < numChunks; ++i) {
+        PartitionChunkTask<RandomIterator, KeyFunction> task = {
+          begin + chunkStarts[i], begin + chunkStarts[i + 1], bit, keyFn,
+          &chunkZeros[i]
+        };
+        group.Spawn(task);
+      }
+      group.Wait();
+    }
+
+    /* The boundary is at the total number of 0s. */
+    size_t boundary = 0;
+    for (size_t i = 0; i < numChunks; ++i)
+      boundary += chunkZeros[i];
+
+    /* Phase two: gather up the runs of 1s left of the boundary and the runs
+     * of 0s right of it.
+     */
+    std::vector<Interval> ones, zeros;
+    std::vector<size_t> oneTotals(1, 0), zeroTotals(1, 0);
+    for (size_t i = 0; i < numChunks; ++i) {
+      const size_t split = chunkStarts[i] + chunkZeros[i];
+      AppendIntersection(ones,  oneTotals,  split, chunkStarts[i + 1], 0, boundary);
+      AppendIntersection(zeros, zeroTotals, chunkStarts[i], split, boundary, numElems);
+    }
+
+    /* Phase three: exchange them, splitting the swaps evenly.  This phase
+     * gets its own group, declared after the runs it reads, so that if we
+     * leave early the group waits for its tasks before the runs go away.
+     */
+    const size_t numMisplaced = oneTotals.back();
+    {
+      TaskGroup<Executor> group(executor);
+      for (size_t i = 0; i < numChunks; ++i) {
+        SwapMisplacedTask<RandomIterator> task = {
+          begin, &ones, &oneTotals, &zeros, &zeroTotals,
+          numMisplaced / numChunks * i + std::min(i, numMisplaced % numChunks),
+          numMisplaced / numChunks * (i + 1) + std::min(i + 1, numMisplaced % numChunks)
+        };
+        group.Spawn(task);
+      }
+      group.Wait();
+    }
+
+    return begin + boundary;
+  }
+
+  /* A task that computes VaryingBits over one chunk of a range. */
+  template <typename RandomIterator, typename KeyFunction>
+  struct VaryingBitsTask {
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType KeyType;
+
+    RandomIterator begin, end;
+    KeyFunction keyFn;
+    KeyType* orBits;
+    KeyType* andBits;
+
+    void operator() () const {
+      KeyType localOr = 0, localAnd = KeyType(~KeyType(0));
+      for (RandomIterator itr = begin; itr != end; ++itr) {
+        const KeyType key = RadixKey(keyFn(*itr));
+        localOr  |= key;
+        localAnd &= key;
+      }
+      *orBits  = localOr;
+      *andBits = localAnd;
+    }
+  };
+
+  /* Utility function that computes VaryingBits using all of the executor's
+   * threads, one chunk per thread.
    */
-  template <typename RandomIterator>
-  void RotateNegativeValues(RandomIterator begin, RandomIterator end) {
+  template <typename RandomIterator, typename KeyFunction, typename Executor>
+  typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType
+  ParallelVaryingBits(RandomIterator begin, RandomIterator end,
+                      KeyFunction keyFn, Executor& executor) {
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType KeyType;
+
+    const size_t numElems  = size_t(end - begin);
+    const size_t numChunks = std::max<size_t>(executor.NumThreads(), 1);
+
+    std::vector<KeyType> orBits(numChunks), andBits(numChunks);
+    TaskGroup<Executor> group(executor);
+    for (size_t i = 0; i < numChunks; ++i) {
+      VaryingBitsTask<RandomIterator, KeyFunction> task = {
+        begin + (numElems / numChunks * i + std::min(i, numElems % numChunks)),
+        begin + (numElems / numChunks * (i + 1) + std::min(i + 1, numElems % numChunks)),
+        keyFn, &orBits[i], &andBits[i]
+      };
+      group.Spawn(task);
+    }
+    group.Wait();
+
+    KeyType totalOr = 0, totalAnd = KeyType(~KeyType(0));
+    for (size_t i = 0; i < numChunks; ++i) {
+      totalOr  |= orBits[i];
+      totalAnd &= andBits[i];
+    }
+    return KeyType(totalOr ^ totalAnd);
+  }
+
+  /* Forward declaration of the task type used by ParallelBinaryQuicksortAtBit. */
+  template <typename RandomIterator, typename KeyFunction, typename Executor>
+  struct ParallelBinaryQuicksortTask;
+
+  /* Parallel counterpart of BinaryQuicksortAtBit.  Ranges at least
+   * kParallelCutoff long are partitioned here, the smaller side is spawned
+   * into the task group, and the larger side is processed by this loop.
+   * Anything smaller is sorted sequentially.
+   */
+  template <typename RandomIterator, typename KeyFunction, typename Executor>
+  void ParallelBinaryQuicksortAtBit(RandomIterator begin, RandomIterator end,
+                                    signed int bit,
+                                    typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType varying,
+                                    KeyFunction keyFn,
+                                    TaskGroup<Executor>& group) {
+    while (bit >= 0 && size_t(end - begin) >= kParallelCutoff) {
+      RandomIterator pivot = PartitionAtBit(begin, end, bit, keyFn);
+      --bit;
+
+      /* Skip any bits known to be constant, as BinaryQuicksortAtBit does. */
+      if (pivot == begin || pivot == end) {
+        bit = HighestSetBit(varying, bit);
+        continue;
+      }
+
+      /* Spawn the smaller range and keep the larger one for ourselves. */
+      ParallelBinaryQuicksortTask<RandomIterator, KeyFunction, Executor> task =
+        { begin, end, bit, varying, keyFn, &group };
+      if (pivot - begin < end - pivot) {
+        task.end = pivot;
+        begin = pivot;
+      } else {
+        task.begin = pivot;
+        end = pivot;
+      }
+      group.Spawn(task);
+    }
+
+    BinaryQuicksortAtBit(begin, end, bit, varying, keyFn);
+  }
+
+  /* A task that runs ParallelBinaryQuicksortAtBit on a subrange. */
+  template <typename RandomIterator, typename KeyFunction, typename Executor>
+  struct ParallelBinaryQuicksortTask {
+    RandomIterator begin, end;
+    signed int bit;
+    typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType varying;
+    KeyFunction keyFn;
+    TaskGroup<Executor>* group;
+
+    void operator() () const {
+      ParallelBinaryQuicksortAtBit(begin, end, bit, varying, keyFn, *group);
+    }
+  };
+
+  /* A compact stand-in for a record, used by BinaryQuicksortIndirect. */
+  template <typename Key> struct KeyIndexPair {
+    Key key;      // The record's key
+    size_t index; // Where the record started out
+  };
+
+  /* A key function that reads the key out of a KeyIndexPair. */
+  struct PairKey {
+    template <typename Key>
+    const Key& operator() (const KeyIndexPair<Key>& pair) const {
+      return pair.key;
+    }
+  };
+
+  /* Utility function that rearranges the range so that position i receives
+   * the element that was at position sources[i], moving each element only
+   * once.
+   *
+   * A permutation breaks up into disjoint cycles.  For each cycle, we lift
+   * the first element into a temporary, leaving a hole behind.  We then fill
+   * the hole with the element that belongs there, which opens up a hole
+   * where that element used to be, and so on around the cycle until the hole
+   * is where the temporary belongs.  Finished positions are marked by
+   * pointing them at themselves.
+   */
+  template <typename RandomIterator, typename Key>
+  void ApplyPermutation(RandomIterator begin,
+                        std::vector< KeyIndexPair<Key> >& sources) {
     /* Typedef defining the type of the elements being traversed. */
     typedef typename std::iterator_traits<RandomIterator>::value_type T;
 
-    /* Walk forward until we find a negative value.  If we find one, do a
-     * rotate to rectify the elements.
-     */
-    for (RandomIterator itr = begin; itr != end; ++itr) {
-      /* If the value is negative, do a rotate starting here. */
-      if (*itr < T(0)) {
-        std::rotate(begin, itr, end);
-        return;
+    for (size_t start = 0; start < sources.size(); ++start) {
+      if (sources[start].index == start) continue;
+
+      T value = std::move(*(begin + start));
+      size_t hole = start;
+      while (true) {
+        const size_t source = sources[hole].index;
+        sources[hole].index = hole;
+        if (source == start) break;
+
+        *(begin + hole) = std::move(*(begin + source));
+        hole = source;
       }
+      *(begin + hole) = std::move(value);
     }
   }
 }
 
-/* Actual implementation of binary quicksort. */
+/* Actual implementation of binary quicksort, sorting records by a key. */
+template <typename RandomIterator, typename KeyFunction>
+void BinaryQuicksort(RandomIterator begin, RandomIterator end,
+                     KeyFunction keyFn) {
+    /* Grant access to our helper functions. */
+    using namespace binaryquicksort_detail;
+
+    /* Typedef defining the type of the keys being sorted. */
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType KeyType;
+
+    /* Find out how many bits we need to process. */
+    const signed int kNumBits = (signed int)(CHAR_BIT * sizeof(KeyType));
+
+    /* Find the highest bit that differs between any two of the keys.  All
+     * the bits above it are shared by every key and would only cost us a
+     * pass apiece without moving anything.
+     */
+    const KeyType varying = VaryingBits(begin, end, keyFn);
+    const signed int topBit = HighestSetBit(varying, kNumBits - 1);
+
+    /* Run binary quicksort on the elements, starting with that bit. */
+    BinaryQuicksortAtBit(begin, end, topBit, varying, keyFn);
+}
+
+/* Sorting bare numbers just uses each number as its own key. */
 template <typename RandomIterator>
 void BinaryQuicksort(RandomIterator begin, RandomIterator end) {
-    /* Typedef defining the type of the elements being traversed. */
-    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+    BinaryQuicksort(begin, end, binaryquicksort_detail::IdentityKey());
+}
+
+/* Implementation of indirect binary quicksort. */
+template <typename RandomIterator, typename KeyFunction>
+void BinaryQuicksortIndirect(RandomIterator begin, RandomIterator end,
+                             KeyFunction keyFn) {
+    /* Grant access to our helper functions. */
+    using namespace binaryquicksort_detail;
+
+    /* Typedef defining the type of the keys being sorted. */
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::ValueType Key;
+
+    /* Pull out each record's key along with where it came from. */
+    std::vector< KeyIndexPair<Key> > pairs;
+    pairs.reserve(size_t(end - begin));
+    for (RandomIterator itr = begin; itr != end; ++itr) {
+      KeyIndexPair<Key> pair = { keyFn(*itr), size_t(itr - begin) };
+      pairs.push_back(pair);
+    }
+
+    /* Sort the pairs, then move the records to match. */
+    BinaryQuicksort(pairs.begin(), pairs.end(), PairKey());
+    ApplyPermutation(begin, pairs);
+}
+
+/* Implementation of parallel binary quicksort, sorting records by a key. */
+template <typename RandomIterator, typename KeyFunction, typename Executor>
+void ParallelBinaryQuicksort(RandomIterator begin, RandomIterator end,
+                             KeyFunction keyFn, Executor& executor) {
+    /* Grant access to our helper functions. */
+    using namespace binaryquicksort_detail;
+
+    /* Typedef defining the type of the keys being sorted. */
+    typedef typename ProjectionTraits<RandomIterator, KeyFunction>::KeyType KeyType;
 
     /* Find out how many bits we need to process. */
-    const signed int kNumBits = (signed int)(CHAR_BIT * sizeof(T));
+    const signed int kNumBits = (signed int)(CHAR_BIT * sizeof(KeyType));
+
+    /* Small inputs aren't worth the coordination; sort them directly. */
+    if (size_t(end - begin) < kParallelCutoff) {
+      BinaryQuicksort(begin, end, keyFn);
+      return;
+    }
 
-    /* Run binary quicksort on the elements, starting with the MSD. */
-    binaryquicksort_detail::BinaryQuicksortAtBit(begin, end, kNumBits - 1);
+    /* Skip over the high bits shared by every key, as in the sequential
+     * version.  If nothing varies, every key is equal and we're done.
+     */
+    const KeyType varying = ParallelVaryingBits(begin, end, keyFn, executor);
+    const signed int topBit = HighestSetBit(varying, kNumBits - 1);
+    if (topBit < 0) return;
 
-    /* If the numbers are signed, we need to do a rotate to pull all of the
-     * negative numbers to the front of the range, since otherwise (because
-     * their MSB is set) they'll be at the end instead of the front.
+    /* Split the range on the highest varying bit using every thread, then
+     * sort the two halves as independent tasks.
      */
-    if (std::numeric_limits<T>::is_signed)
-      binaryquicksort_detail::RotateNegativeValues(begin, end);
+    RandomIterator pivot =
+      ParallelPartitionAtBit(begin, end, topBit, keyFn, executor);
+
+    TaskGroup<Executor> group(executor);
+    ParallelBinaryQuicksortTask<RandomIterator, KeyFunction, Executor> lower =
+      { begin, pivot, topBit - 1, varying, keyFn, &group };
+    ParallelBinaryQuicksortTask<RandomIterator, KeyFunction, Executor> upper =
+      { pivot, end, topBit - 1, varying, keyFn, &group };
+    group.Spawn(lower);
+    upper();
+    group.Wait();
+}
+
+/* Sorting bare numbers in parallel uses each number as its own key. */
+template <typename RandomIterator, typename Executor>
+void ParallelBinaryQuicksort(RandomIterator begin, RandomIterator end,
+                             Executor& executor) {
+    ParallelBinaryQuicksort(begin, end, binaryquicksort_detail::IdentityKey(),
+                            executor);
 }
 
 #endif
@@ -8,6 +8,9 @@
 #ifndef CARTESIANTREESORT_H
 #define CARTESIANTREESORT_H
 
+#include <cstddef>    // For size_t
+#include <functional> // For less
+
 /**
  * void CartesianTreeSort(ForwardIterator begin, ForwardIterator end);
  * Usage: CartesianTreeSort(v.begin(), v.end());
@@ -30,97 +33,205 @@ template <typename ForwardIterator, typename Comparator>
 void CartesianTreeSort(ForwardIterator begin, ForwardIterator end,
                        Comparator comp);
 
+/**
+ * class IncrementalCartesianSorter<T, Comparator>;
+ * Usage: IncrementalCartesianSorter<Record, ByTimestamp> sorter;
+ *        sorter.push(record);
+ *        sorter.watermark(oldestPossibleRecord);
+ *        for (Record r; sorter.pull(r); ) Emit(r);
+ * ---------------------------------------------------------------------------
+ * A Cartesian tree sort that accepts its input one value at a time and hands
+ * values back in ascending order (according to the comparator) as soon as it
+ * is safe to do so.  Values are added with push().  A call to watermark(x)
+ * promises that no value pushed afterwards will compare less than x, which
+ * lets every value pushed so far that is no greater than x be pulled right
+ * away.  A call to seal() promises that nothing more will be pushed at all,
+ * after which every remaining value can be pulled.  On nearly-sorted input
+ * with regular watermarks, values flow through with bounded latency and the
+ * sorter only holds onto values that are not yet known to be in order.
+ */
+template <typename T, typename Comparator = std::less<T> >
+class IncrementalCartesianSorter;
+
+/**
+ * void CartesianTreePartialSort(ForwardIterator begin, ForwardIterator middle,
+ *                               ForwardIterator end);
+ * void CartesianTreePartialSort(ForwardIterator begin, ForwardIterator middle,
+ *                               ForwardIterator end, Comparator comp);
+ * Usage: CartesianTreePartialSort(v.begin(), v.begin() + 10, v.end());
+ * ---------------------------------------------------------------------------
+ * Rearranges the range [begin, end) so that [begin, middle) holds its
+ * smallest middle - begin values in ascending order (according to comp, or
+ * the default ordering), like std::partial_sort.  The remaining values end
+ * up in [middle, end) in their original relative order.  Building the tree
+ * takes O(n) time and extracting the k smallest values from it takes
+ * O(k lg k), so nothing is spent sorting the values that aren't wanted.
+ */
+template <typename ForwardIterator>
+void CartesianTreePartialSort(ForwardIterator begin, ForwardIterator middle,
+                              ForwardIterator end);
+template <typename ForwardIterator, typename Comparator>
+void CartesianTreePartialSort(ForwardIterator begin, ForwardIterator middle,
+                              ForwardIterator end, Comparator comp);
+
+/**
+ * OutputIterator CartesianTreeTopK(ForwardIterator begin, ForwardIterator end,
+ *                                  size_t k, OutputIterator out);
+ * OutputIterator CartesianTreeTopK(ForwardIterator begin, ForwardIterator end,
+ *                                  size_t k, OutputIterator out,
+ *                                  Comparator comp);
+ * Usage: CartesianTreeTopK(v.begin(), v.end(), 10, std::back_inserter(best));
+ * ---------------------------------------------------------------------------
+ * Writes copies of the k smallest values in [begin, end) to out in ascending
+ * order (according to comp, or the default ordering), leaving the input
+ * untouched, and returns an iterator one past the last value written.  If
+ * the range holds fewer than k values, all of them are written.  This runs
+ * in O(n + k lg k) time.
+ */
+template <typename ForwardIterator, typename OutputIterator>
+OutputIterator CartesianTreeTopK(ForwardIterator begin, ForwardIterator end,
+                                 size_t k, OutputIterator out);
+template <typename ForwardIterator, typename OutputIterator,
+          typename Comparator>
+OutputIterator CartesianTreeTopK(ForwardIterator begin, ForwardIterator end,
+                                 size_t k, OutputIterator out,
+                                 Comparator comp);
+
+/**
+ * void ParallelCartesianTreeSort(RandomIterator begin, RandomIterator end,
+ *                                Comparator comp, Executor& executor);
+ * Usage: WorkStealingPool pool;
+ *        ParallelCartesianTreeSort(v.begin(), v.end(), std::less<int>(), pool);
+ * ---------------------------------------------------------------------------
+ * Sorts the range [begin, end) into ascending order according to comp using
+ * Cartesian tree sort, building the tree in parallel on the executor.
+ * Rather than inserting the values one at a time, the parallel build finds
+ * each value's parent directly from its nearest smaller values on either
+ * side, which can be computed chunk by chunk and then stitched together.  The
+ * resulting tree is exactly the one the sequential build produces, and it is
+ * consumed by the same sequential frontier, so the output is identical.
+ * Small inputs are sorted sequentially.
+ */
+template <typename RandomIterator, typename Comparator, typename Executor>
+void ParallelCartesianTreeSort(RandomIterator begin, RandomIterator end,
+                               Comparator comp, Executor& executor);
+
 /* * * * * Implementation Below This Point * * * * */
-#include <iterator>   // For iterator_traits
+#include <algorithm>  // For min, max, reverse
+#include <climits>    // For CHAR_BIT
+#include <cstddef>    // For size_t
+#include <cstdint>    // For uint32_t
+#include <iterator>   // For iterator_traits, distance, make_move_iterator
 #include <functional> // For less
-#include <memory>     // For auto_ptr
 #include <stack>
-#include <queue>
+#include <type_traits>
+#include <utility>    // For move, forward
 #include <vector>
+#include "binaryquicksort.h"
+#include "workstealingpool.h"
 
 namespace cartesiantreesort_detail {
-  /* A utility struct representing a node in a Cartesian tree. */
-  template <typename T> struct Node {
-    const T value;      // The node's value
-    Node* left, *right; // Pointers to the proper subtrees
+  /* Index NoNode<Index>();
+   * Usage: if (node.left != NoNode<Index>()) { ... }
+   * -------------------------------------------------------------------------
+   * Returns the sentinel index used in place of a missing node.
+   */
+  template <typename Index> Index NoNode() {
+    return Index(-1);
+  }
 
-    /* Constructor: Node(const T& value);
-     * Usage: Node* node = new Node(value);
-     * -----------------------------------------------------------------------
-     * Constructs a new Node having the specified value and no children.
-     */
-    explicit Node(const T& value) : value(value) {
-      /* Initially this node is isolated. */
-      left = right = NULL;
-    }
+  /* A utility struct representing a node in a Cartesian tree.  All of the
+   * nodes of a tree live in a single array (the arena), and children are
+   * referred to by their index in that array.  This means that building the
+   * tree makes one allocation rather than one per node, that the nodes sit
+   * next to one another in memory, and that the whole tree is freed in one go
+   * when the array is.  The index type is a template parameter so that trees
+   * with fewer than 2^32 nodes can use 32-bit indices, which keeps the nodes
+   * small on 64-bit machines.
+   *
+   * On sorted or reverse-sorted input the tree degrades into a path as long
+   * as the input itself, so nothing in this file may walk the tree by
+   * recursion.  Nodes deliberately have no destructor that frees their
+   * children; the tree is built with an explicit stack, consumed through an
+   * explicit priority queue, and torn down by releasing the arena, all in
+   * constant call-stack space regardless of the tree's height.
+   */
+  template <typename T, typename Index> struct Node {
+    T value;            // The node's value
+    Index left, right;  // Indices of the proper subtrees, or NoNode
 
-    /* Destructor: ~Node();
-     * Usage: (implicit)
+    /* Constructor: Node(U&& value);
+     * Usage: nodes.emplace_back(std::move(value));
      * -----------------------------------------------------------------------
-     * Deallocates the tree rooted at this Node.
+     * Constructs a new Node having the specified value and no children.  The
+     * value is moved in if it is an rvalue and copied otherwise.
      */
-    ~Node() {
-      delete left;
-      delete right;
+    template <typename U>
+    explicit Node(U&& value) : value(std::forward<U>(value)) {
+      /* Initially this node is isolated. */
+      left = right = NoNode<Index>();
     }
   };
 
-  /* Node<T>* MakeCartesianTree(InputIterator begin, InputIterator end,
-   *                            Comparator comp);
-   * Usage: Node<T>* tree = MakeCartesianTree(begin, end, comp);
+  /* Index MakeCartesianTree(InputIterator begin, InputIterator end,
+   *                         Comparator comp,
+   *                         std::vector< Node<T, Index> >& nodes);
+   * Usage: Index root = MakeCartesianTree(begin, end, comp, nodes);
    * -------------------------------------------------------------------------
-   * Constructs and returns a Cartesian tree containing the specified values
-   * and sorted as a min-heap with respect to the given comparator.  The
-   * return type of this function is a bit messy because it has to introspect
-   * on the iterator type to figure out what's being stored.
+   * Constructs a Cartesian tree containing the specified values and sorted as
+   * a min-heap with respect to the given comparator.  The nodes are appended
+   * to the given arena, and the index of the root is returned (or NoNode if
+   * the range is empty).  Each value is constructed from *begin, so passing
+   * move iterators moves the values into the tree rather than copying them.
+   * Callers that know the length of the range should reserve space in the
+   * arena first so that it is allocated only once.
    */
-  template <typename InputIterator, typename Comparator>
-  Node<typename std::iterator_traits<InputIterator>::value_type>*
-  MakeCartesianTree(InputIterator begin, InputIterator end,
-                    Comparator comp) {
-    /* For sanity's sake, typedef the type being iterated over. */
-    typedef typename std::iterator_traits<InputIterator>::value_type T;
-
-    /* Keep track of the root of the tree, which is initially NULL because the
-     * tree is empty.
+  template <typename InputIterator, typename Comparator,
+            typename T, typename Index>
+  Index MakeCartesianTree(InputIterator begin, InputIterator end,
+                          Comparator comp,
+                          std::vector< Node<T, Index> >& nodes) {
+    /* Keep track of the root of the tree, which is initially absent because
+     * the tree is empty.
      */
-    Node<T>* root = NULL;
+    Index root = NoNode<Index>();
 
     /* In addition to this, we'll maintain a stack of the nodes on the right
      * spine of the tree, in the order in which you would encounter them if
      * you marched upward from the rightmost node to the root.
      */
-    std::stack< Node<T>* > rightSpine;
+    std::stack< Index, std::vector<Index> > rightSpine;
 
-    /* To avoid edge cases later on, we'll add NULL to the right spine.  This
-     * does make some sense mathematically, since if we walk from the
+    /* To avoid edge cases later on, we'll add NoNode to the right spine.
+     * This does make some sense mathematically, since if we walk from the
      * rightmost node to the root and upward we'd walk off the tree at some
      * point.
      */
-    rightSpine.push(NULL);
+    rightSpine.push(NoNode<Index>());
 
     /* Scan across the elements, adding them one at a time. */
     for (; begin != end; ++begin) {
       /* Construct the new node to insert. */
-      Node<T>* node = new Node<T>(*begin);
+      const Index node = Index(nodes.size());
+      nodes.emplace_back(*begin);
 
       /* Starting at the rightmost node, walk upward along the right spine
        * until we find a node that can serve as the parent.  Because the spine
-       * is never empty (NULL will always be there), we don't need to worry
-       * about an empty stack.
+       * is never empty (NoNode will always be there), we don't need to
+       * worry about an empty stack.
        */
-      Node<T>* curr;
-      for (curr = rightSpine.top(); curr != NULL; rightSpine.pop(), curr = rightSpine.top())
-        if (comp(curr->value, node->value))
+      Index curr;
+      for (curr = rightSpine.top(); curr != NoNode<Index>(); rightSpine.pop(), curr = rightSpine.top())
+        if (comp(nodes[curr].value, nodes[node].value))
           break;
 
       /* At this point, there are two cases to consider.  First, this new node
        * might be the new minimum.  In that case, we make it the global tree
        * root, and to preserve the inorder walk requirement make the old tree
-       * its right child.
+       * its left child.
        */
-      if (curr == NULL) {
-        node->left = root;
+      if (curr == NoNode<Index>()) {
+        nodes[node].left = root;
         root = node;
       }
       /* Otherwise, we need to pull the current node's right subtree so that
@@ -128,8 +239,8 @@ namespace cartesiantreesort_detail {
        * as the right child of the current node.
        */
       else {
-        node->left = curr->right;
-        curr->right = node;
+        nodes[node].left = nodes[curr].right;
+        nodes[curr].right = node;
       }
 
       /* This new node is now on the right spine, so we'll add it to the stack
@@ -142,39 +253,741 @@ namespace cartesiantreesort_detail {
     return root;
   }
 
-  /* A utility comparator class that compares Node<T>*s by the reverse of
-   * their comparison by some comparator.  The rationale is that we will use
-   * this comparator in a priority_queue of Node<T>*s, and will need some way
-   * to ensure that the nodes are compared so that the smallest elements come
-   * back first.
+  /* A utility struct holding one entry of a FrontierHeap.  For scalar types,
+   * which are cheap to copy, the entry carries its own copy of the node's
+   * value, so comparing two entries never has to chase an index into the
+   * arena.  For anything else it holds just the node's index, and the value
+   * is looked up in the arena when needed.
    */
-  template <typename T, typename Comparator>
-  class NodeComparator {
+  template <typename T, typename Index,
+            bool kInline = std::is_scalar<T>::value>
+  struct FrontierEntry {
+    T value;    // A copy of the node's value
+    Index node; // The node's index in the arena
+
+    FrontierEntry(const std::vector< Node<T, Index> >& nodes, Index node)
+      : value(nodes[node].value), node(node) {
+      // Handled in initializer list
+    }
+
+    const T& Value(const std::vector< Node<T, Index> >&) const {
+      return value;
+    }
+  };
+
+  template <typename T, typename Index>
+  struct FrontierEntry<T, Index, false> {
+    Index node; // The node's index in the arena
+
+    FrontierEntry(const std::vector< Node<T, Index> >&, Index node)
+      : node(node) {
+      // Handled in initializer list
+    }
+
+    const T& Value(const std::vector< Node<T, Index> >& nodes) const {
+      return nodes[node].value;
+    }
+  };
+
+  /* A utility class holding the frontier of exposed Cartesian tree roots as
+   * a d-ary min-heap with respect to a comparator.  A 4-ary heap is half as
+   * tall as a binary heap, and the four children of a node sit side by side
+   * in memory, so sifting an entry down touches far fewer cache lines.
+   * Sifting moves entries into a hole instead of swapping them.
+   */
+  template <typename T, typename Index, typename Comparator>
+  class FrontierHeap {
   public:
-    /* Constructor: NodeComparator(Comparator comp);
-     * Usage: NodeComparator comp(rawComp);
+    /* Constructor: FrontierHeap(const std::vector< Node<T, Index> >& nodes,
+     *                           Comparator comp, size_t capacity);
+     * Usage: FrontierHeap<T, Index, Comparator> heap(nodes, comp, n / 2 + 1);
      * -----------------------------------------------------------------------
-     * Constructs a new NodeComparator that uses the specified comparator on
-     * the values in Node<T>*s.
+     * Constructs an empty frontier over the given arena, reserving room for
+     * the given number of entries.
      */
-    explicit NodeComparator(Comparator comp) : comp(comp) {
+    FrontierHeap(const std::vector< Node<T, Index> >& nodes, Comparator comp,
+                 size_t capacity) : nodes(&nodes), comp(comp) {
+      entries.reserve(capacity);
+    }
+
+    /* bool empty() const;
+     * Index top() const;
+     * void push(Index node);
+     * void pop();
+     * -----------------------------------------------------------------------
+     * The usual priority queue operations, with top() returning the index of
+     * the node having the smallest value.
+     */
+    bool empty() const {
+      return entries.empty();
+    }
+
+    Index top() const {
+      return entries.front().node;
+    }
+
+    void push(Index node) {
+      /* Open a hole at the end and move it up until the new entry fits. */
+      Entry entry(*nodes, node);
+      size_t hole = entries.size();
+      entries.push_back(entry);
+
+      while (hole > 0) {
+        const size_t parent = (hole - 1) / kArity;
+        if (!Less(entry, entries[parent])) break;
+
+        entries[hole] = entries[parent];
+        hole = parent;
+      }
+      entries[hole] = entry;
+    }
+
+    void pop() {
+      /* Take the last entry out and move the hole at the root down until
+       * that entry fits.
+       */
+      const Entry entry = entries.back();
+      entries.pop_back();
+      if (entries.empty()) return;
+
+      const size_t size = entries.size();
+      size_t hole = 0;
+      while (true) {
+        /* Find the smallest of this node's children, if it has any. */
+        const size_t first = hole * kArity + 1;
+        if (first >= size) break;
+
+        const size_t last = first + kArity < size? first + kArity : size;
+        size_t smallest = first;
+        for (size_t child = first + 1; child < last; ++child)
+          if (Less(entries[child], entries[smallest]))
+            smallest = child;
+
+        if (!Less(entries[smallest], entry)) break;
+
+        entries[hole] = entries[smallest];
+        hole = smallest;
+      }
+      entries[hole] = entry;
+    }
+
+  private:
+    typedef FrontierEntry<T, Index> Entry;
+
+    /* The number of children of each heap node. */
+    static const size_t kArity = 4;
+
+    /* Returns whether lhs's value is less than rhs's. */
+    bool Less(const Entry& lhs, const Entry& rhs) const {
+      return comp(lhs.Value(*nodes), rhs.Value(*nodes));
+    }
+
+    const std::vector< Node<T, Index> >* nodes; // The arena holding the nodes
+    Comparator comp;                            // The comparator to use
+    std::vector<Entry> entries;                 // The heap itself
+  };
+
+  /* size_t BitLength(KeyType value);
+   * Usage: size_t bucket = BitLength(key ^ last);
+   * -------------------------------------------------------------------------
+   * Returns the number of bits needed to write value, which is zero for zero.
+   */
+  template <typename KeyType>
+  size_t BitLength(KeyType value) {
+    size_t length = 0;
+#if defined(__GNUC__) || defined(__clang__)
+    if (value != 0)
+      length = CHAR_BIT * sizeof(unsigned long long) -
+               size_t(__builtin_clzll((unsigned long long)value));
+#else
+    for (; value != 0; value >>= 1)
+      ++length;
+#endif
+    return length;
+  }
+
+  /* A utility class holding the frontier of exposed Cartesian tree roots as
+   * a radix heap, for integer values compared with std::less.  A radix heap
+   * only works if every value pushed is at least the last value popped,
+   * which always holds here because a node's children are never smaller
+   * than the node itself.
+   *
+   * Each value is mapped to the same order-preserving unsigned key that
+   * BinaryQuicksort uses (see RadixTraits) and stored in the bucket numbered
+   * by the highest bit in which it differs from the last key popped.  Bucket
+   * zero holds entries equal to that key.  When bucket zero runs dry, the
+   * lowest nonempty bucket is emptied out: its smallest key becomes the new
+   * last key, and its entries are redistributed into strictly lower buckets.
+   * Each entry can only move down so many times, so this costs O(1)
+   * amortized per operation for fixed-width keys, with no comparisons at all
+   * in the common case of long sorted runs.
+   */
+  template <typename T, typename Index>
+  class RadixFrontier {
+  public:
+    /* Constructor: RadixFrontier(const std::vector< Node<T, Index> >& nodes,
+     *                            size_t capacity);
+     * Usage: RadixFrontier<T, Index> frontier(nodes, n / 2 + 1);
+     * -----------------------------------------------------------------------
+     * Constructs an empty frontier over the given arena.
+     */
+    RadixFrontier(const std::vector< Node<T, Index> >& nodes, size_t)
+      : nodes(&nodes), buckets(CHAR_BIT * sizeof(KeyType) + 1),
+        last(0), numEntries(0) {
       // Handled in initializer list
     }
 
-    /* Comparator: bool operator() (const Node<T>* lhs, const Node<T>* rhs) const;
-     * Usage: comp(one, two);
+    /* bool empty() const;
+     * Index top();
+     * void push(Index node);
+     * void pop();
      * -----------------------------------------------------------------------
-     * Returns whether the first node compares at least as large as the second
-     * node using the stored comparator.
+     * The usual priority queue operations, with top() returning the index of
+     * the node having the smallest value.
      */
-    bool operator() (const Node<T>* lhs, const Node<T>* rhs) const {
-      /* Check if lhs >= rhs by seeing if lhs < rhs returns false. */
-      return !comp(lhs->value, rhs->value);
+    bool empty() const {
+      return numEntries == 0;
+    }
+
+    Index top() {
+      Refill();
+      return buckets[0].back().node;
+    }
+
+    void push(Index node) {
+      const Entry entry = { Traits::ToKey((*nodes)[node].value), node };
+      buckets[BitLength(KeyType(entry.key ^ last))].push_back(entry);
+      ++numEntries;
+    }
+
+    void pop() {
+      Refill();
+      buckets[0].pop_back();
+      --numEntries;
     }
 
   private:
-    Comparator comp; // The actual comparator to use
+    typedef binaryquicksort_detail::RadixTraits<T> Traits;
+    typedef typename Traits::KeyType KeyType;
+
+    /* An entry in a bucket: a node and its key. */
+    struct Entry {
+      KeyType key;
+      Index node;
+    };
+
+    /* Ensures that bucket zero holds the smallest entries. */
+    void Refill() {
+      if (!buckets[0].empty()) return;
+
+      /* Find the lowest nonempty bucket and its smallest key. */
+      size_t bucket = 1;
+      while (buckets[bucket].empty())
+        ++bucket;
+
+      std::vector<Entry>& source = buckets[bucket];
+      last = source[0].key;
+      for (size_t i = 1; i < source.size(); ++i)
+        last = std::min(last, source[i].key);
+
+      /* Everything in this bucket now belongs in a lower one. */
+      for (size_t i = 0; i < source.size(); ++i)
+        buckets[BitLength(KeyType(source[i].key ^ last))].push_back(source[i]);
+      source.clear();
+    }
+
+    const std::vector< Node<T, Index> >* nodes; // The arena holding the nodes
+    std::vector< std::vector<Entry> > buckets;  // Entries by distance from last
+    KeyType last;                               // The last key popped
+    size_t numEntries;                          // Total entries in all buckets
   };
+
+  /* A traits type choosing the frontier for a given value type and
+   * comparator: the radix heap for integers (other than bool) sorted by
+   * std::less, and the d-ary heap for everything else.
+   */
+  template <typename T, typename Index, typename Comparator>
+  struct FrontierFor {
+    typedef FrontierHeap<T, Index, Comparator> type;
+
+    static type Make(const std::vector< Node<T, Index> >& nodes,
+                     Comparator comp, size_t capacity) {
+      return type(nodes, comp, capacity);
+    }
+  };
+
+  template <typename T, typename Index, bool kIntegral =
+              std::is_integral<T>::value && !std::is_same<T, bool>::value>
+  struct RadixFrontierFor {
+    typedef FrontierHeap<T, Index, std::less<T> > type;
+
+    static type Make(const std::vector< Node<T, Index> >& nodes,
+                     std::less<T> comp, size_t capacity) {
+      return type(nodes, comp, capacity);
+    }
+  };
+
+  template <typename T, typename Index>
+  struct RadixFrontierFor<T, Index, true> {
+    typedef RadixFrontier<T, Index> type;
+
+    static type Make(const std::vector< Node<T, Index> >& nodes,
+                     std::less<T>, size_t capacity) {
+      return type(nodes, capacity);
+    }
+  };
+
+  template <typename T, typename Index>
+  struct FrontierFor<T, Index, std::less<T> > : RadixFrontierFor<T, Index> {};
+
+  /* OutputIterator MoveSmallestOutOfTree(std::vector< Node<T, Index> >& nodes,
+   *                                      Index root, size_t count,
+   *                                      OutputIterator out, Comparator comp,
+   *                                      std::vector<bool>* taken);
+   * Usage: MoveSmallestOutOfTree(nodes, root, numElems, begin, comp, NULL);
+   * -------------------------------------------------------------------------
+   * Given a Cartesian tree holding at least count values, moves its count
+   * smallest values out to the given output iterator in sorted order and
+   * returns the iterator one past the last value written.  This is the second
+   * half of Cartesian tree sort, shared by every way of building the tree
+   * and by the partial sorts.  Each extraction costs O(lg k) time, so the
+   * whole call costs O(k lg k) on top of building the tree.  If taken is
+   * non-NULL, the entry for each node whose value is moved out is set.
+   */
+  template <typename Index, typename T, typename OutputIterator,
+            typename Comparator>
+  OutputIterator MoveSmallestOutOfTree(std::vector< Node<T, Index> >& nodes,
+                                       Index root, size_t count,
+                                       OutputIterator out, Comparator comp,
+                                       std::vector<bool>* taken) {
+    /* The type of the frontier holding the exposed roots. */
+    typedef FrontierFor<T, Index, Comparator> Frontier;
+
+    if (count == 0) return out;
+
+    /* Construct the frontier, wrapping up the comparator provided by the
+     * client.  It never holds more entries than there are leaves in the tree,
+     * nor more than one more than the number of values extracted so far, so
+     * that's how much room it reserves.
+     */
+    typename Frontier::type pq =
+      Frontier::Make(nodes, comp, std::min(count, nodes.size() / 2) + 1);
+
+    /* Initialize the priority queue to hold the Cartesian tree of the input. */
+    pq.push(root);
+
+    /* Now, repeatedly write out the smallest known value and update the
+     * queue accordingly.
+     */
+    for (; count != 0; --count) {
+      /* Grab the next node from the queue. */
+      const Index curr = pq.top(); pq.pop();
+
+      /* Move its value out.  Nothing compares against this node again, so
+       * it's safe to leave it moved-from.
+       */
+      *out = std::move(nodes[curr].value);
+      ++out;
+      if (taken) (*taken)[curr] = true;
+
+      /* Add any non-missing subtrees of the current tree back into the queue. */
+      if (nodes[curr].left  != NoNode<Index>()) pq.push(nodes[curr].left);
+      if (nodes[curr].right != NoNode<Index>()) pq.push(nodes[curr].right);
+    }
+    return out;
+  }
+
+  /* void CartesianTreeSortWithIndex(ForwardIterator begin,
+   *                                 ForwardIterator end,
+   *                                 size_t numElems, Comparator comp);
+   * Usage: CartesianTreeSortWithIndex<uint32_t>(begin, end, numElems, comp);
+   * -------------------------------------------------------------------------
+   * Runs Cartesian tree sort on the numElems values in [begin, end), using
+   * the given type for the indices of the tree's nodes.  Each value is moved
+   * into the tree once and moved back out once, so no values are copied.
+   */
+  template <typename Index, typename ForwardIterator, typename Comparator>
+  void CartesianTreeSortWithIndex(ForwardIterator begin, ForwardIterator end,
+                                  size_t numElems, Comparator comp) {
+    /* Again, for sanity's sake, typedef the type being iterated over. */
+    typedef typename std::iterator_traits<ForwardIterator>::value_type T;
+
+    /* Move the input into a Cartesian tree.  The arena is sized up front so
+     * that all of the nodes are allocated at once, and it releases them all
+     * at once when it goes out of scope.
+     */
+    std::vector< Node<T, Index> > nodes;
+    nodes.reserve(numElems);
+    const Index root = MakeCartesianTree(std::make_move_iterator(begin),
+                                         std::make_move_iterator(end),
+                                         comp, nodes);
+
+    /* Move the values back out in sorted order. */
+    MoveSmallestOutOfTree(nodes, root, numElems, begin, comp,
+                          static_cast<std::vector<bool>*>(NULL));
+  }
+
+  /* void CartesianTreePartialSortWithIndex(ForwardIterator begin,
+   *                                        ForwardIterator middle,
+   *                                        ForwardIterator end,
+   *                                        size_t numElems, Comparator comp);
+   * Usage: CartesianTreePartialSortWithIndex<uint32_t>(begin, middle, end,
+   *                                                    numElems, comp);
+   * -------------------------------------------------------------------------
+   * Runs the partial sort on the numElems values in [begin, end), using the
+   * given type for the indices of the tree's nodes.
+   */
+  template <typename Index, typename ForwardIterator, typename Comparator>
+  void CartesianTreePartialSortWithIndex(ForwardIterator begin,
+                                         ForwardIterator middle,
+                                         ForwardIterator end,
+                                         size_t numElems, Comparator comp) {
+    typedef typename std::iterator_traits<ForwardIterator>::value_type T;
+
+    /* Move the input into a Cartesian tree, as in the full sort. */
+    std::vector< Node<T, Index> > nodes;
+    nodes.reserve(numElems);
+    const Index root = MakeCartesianTree(std::make_move_iterator(begin),
+                                         std::make_move_iterator(end),
+                                         comp, nodes);
+
+    /* Move the smallest values into [begin, middle), remembering which nodes
+     * they came from.
+     */
+    std::vector<bool> taken(numElems);
+    MoveSmallestOutOfTree(nodes, root, size_t(std::distance(begin, middle)),
+                          begin, comp, &taken);
+
+    /* Move everything else back into [middle, end).  Walking the arena in
+     * order rather than the leftover subtrees keeps these values in their
+     * original relative order.
+     */
+    for (size_t i = 0; i < numElems; ++i) {
+      if (!taken[i]) {
+        *middle = std::move(nodes[i].value);
+        ++middle;
+      }
+    }
+  }
+
+  /* OutputIterator CartesianTreeTopKWithIndex(ForwardIterator begin,
+   *                                           ForwardIterator end,
+   *                                           size_t numElems, size_t k,
+   *                                           OutputIterator out,
+   *                                           Comparator comp);
+   * Usage: CartesianTreeTopKWithIndex<uint32_t>(begin, end, numElems, k,
+   *                                             out, comp);
+   * -------------------------------------------------------------------------
+   * Writes the k smallest of the numElems values in [begin, end) to out in
+   * sorted order, using the given type for the indices of the tree's nodes.
+   */
+  template <typename Index, typename ForwardIterator, typename OutputIterator,
+            typename Comparator>
+  OutputIterator CartesianTreeTopKWithIndex(ForwardIterator begin,
+                                            ForwardIterator end,
+                                            size_t numElems, size_t k,
+                                            OutputIterator out,
+                                            Comparator comp) {
+    typedef typename std::iterator_traits<ForwardIterator>::value_type T;
+
+    /* Copy the input into a Cartesian tree so that it's left untouched.  The
+     * copies are ours, so they can be moved out afterwards.
+     */
+    std::vector< Node<T, Index> > nodes;
+    nodes.reserve(numElems);
+    const Index root = MakeCartesianTree(begin, end, comp, nodes);
+
+    return MoveSmallestOutOfTree(nodes, root, k, out, comp,
+                                 static_cast<std::vector<bool>*>(NULL));
+  }
+
+  /* The parallel builder finds every node's parent directly rather than
+   * inserting the nodes one at a time.  In a Cartesian tree, the parent of
+   * the node at position i is one of its two nearest smaller values: the
+   * closest position L to its left holding a value strictly less than it, or
+   * the closest position R to its right holding a value no greater than it
+   * (the asymmetry matches MakeCartesianTree, which makes a later value the
+   * ancestor of any earlier values equal to it).  Of the two, the parent is
+   * whichever has the larger value, breaking ties toward L, and the node is
+   * that parent's right child if the parent is L and its left child if the
+   * parent is R.
+   * Finding these all-nearest-smaller-values (ANSV) is done in two parallel
+   * phases over fixed chunks of the arena:
+   *
+   * 1. Each chunk runs the usual stack-based scan in each direction, which
+   *    resolves every L and R that lies inside the chunk.  The stacks left
+   *    over at the end are the chunk's right spine (values with nothing
+   *    smaller or equal after them in the chunk) and left spine (values
+   *    strictly smaller than everything before them in the chunk), and only
+   *    the nodes on those spines can have a nearest smaller value in another
+   *    chunk.
+   * 2. Every unresolved node looks for the nearest chunk whose minimum could
+   *    answer it, using a sparse table of chunk minima so that the search
+   *    takes O(lg #chunks) comparisons, then binary searches that chunk's
+   *    spine, whose values are sorted.  With its L and R known, each node
+   *    writes itself into its parent.  Different nodes write different
+   *    fields, so the writes need no synchronization.
+   */
+  template <typename T, typename Index, typename Comparator>
+  struct ParallelTreeBuilder {
+    std::vector< Node<T, Index> >* nodes;      // The arena being linked
+    Comparator comp;                           // Orders the values
+    size_t chunkSize;                          // Nodes per chunk
+    size_t numChunks;                          // Number of chunks
+    std::vector<Index> leftSmaller;            // L for each node, or NoNode
+    std::vector<Index> rightSmaller;           // R for each node, or NoNode
+    std::vector< std::vector<Index> > leftSpines;  // Per chunk, by position
+    std::vector< std::vector<Index> > rightSpines; // Per chunk, by position
+    std::vector< std::vector<Index> > minTable;    // Sparse table of minima
+
+    /* Returns the value stored at the given node. */
+    const T& ValueAt(Index node) const {
+      return (*nodes)[node].value;
+    }
+
+    /* Returns the position one past the end of the given chunk. */
+    size_t ChunkEnd(size_t chunk) const {
+      return std::min(nodes->size(), (chunk + 1) * chunkSize);
+    }
+
+    /* Phase 1: resolve the nearest smaller values within a single chunk and
+     * record its spines.
+     */
+    void ScanChunk(size_t chunk) {
+      const size_t chunkBegin = chunk * chunkSize;
+      const size_t chunkEnd = ChunkEnd(chunk);
+
+      /* Left to right, popping everything no smaller than the current value,
+       * leaves the nearest strictly smaller value on top.
+       */
+      std::vector<Index>& rightSpine = rightSpines[chunk];
+      for (size_t i = chunkBegin; i != chunkEnd; ++i) {
+        while (!rightSpine.empty() &&
+               !comp(ValueAt(rightSpine.back()), ValueAt(Index(i))))
+          rightSpine.pop_back();
+        leftSmaller[i] = rightSpine.empty()? NoNode<Index>() : rightSpine.back();
+        rightSpine.push_back(Index(i));
+      }
+
+      /* Right to left, popping everything strictly greater than the current
+       * value, leaves the nearest smaller-or-equal value on top.
+       */
+      std::vector<Index>& leftSpine = leftSpines[chunk];
+      for (size_t i = chunkEnd; i != chunkBegin; --i) {
+        while (!leftSpine.empty() &&
+               comp(ValueAt(Index(i - 1)), ValueAt(leftSpine.back())))
+          leftSpine.pop_back();
+        rightSmaller[i - 1] = leftSpine.empty()? NoNode<Index>() : leftSpine.back();
+        leftSpine.push_back(Index(i - 1));
+      }
+
+      /* Store the left spine in order of position, like the right spine. */
+      std::reverse(leftSpine.begin(), leftSpine.end());
+    }
+
+    /* Builds the sparse table over the chunk minima, where minTable[k][c]
+     * holds a node with the smallest value in chunks [c, c + 2^k).  The
+     * bottom of each chunk's right spine is that chunk's minimum.
+     */
+    void BuildMinTable() {
+      minTable.push_back(std::vector<Index>(numChunks));
+      for (size_t chunk = 0; chunk < numChunks; ++chunk)
+        minTable[0][chunk] = rightSpines[chunk].front();
+
+      for (size_t width = 1; 2 * width <= numChunks; width *= 2) {
+        const std::vector<Index>& prev = minTable.back();
+        std::vector<Index> next(numChunks - 2 * width + 1);
+        for (size_t chunk = 0; chunk < next.size(); ++chunk)
+          next[chunk] = comp(ValueAt(prev[chunk + width]), ValueAt(prev[chunk]))?
+                        prev[chunk + width] : prev[chunk];
+        minTable.push_back(next);
+      }
+    }
+
+    /* Finds the nearest node before the given chunk whose value is strictly
+     * less than value, or NoNode if there is none.
+     */
+    Index FindLeftSmaller(size_t chunk, const T& value) const {
+      /* Skip back over the longest run of chunks whose minima are all at
+       * least value, taking the largest possible steps first.
+       */
+      size_t pos = chunk;
+      for (size_t k = minTable.size(); k != 0; --k) {
+        const size_t width = size_t(1) << (k - 1);
+        if (pos >= width && !comp(ValueAt(minTable[k - 1][pos - width]), value))
+          pos -= width;
+      }
+      if (pos == 0) return NoNode<Index>();
+
+      /* The chunk just before that run has a smaller value, and the nearest
+       * one is the last entry on its right spine that is smaller.
+       */
+      const std::vector<Index>& spine = rightSpines[pos - 1];
+      size_t lo = 0, hi = spine.size();
+      while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (comp(ValueAt(spine[mid]), value)) lo = mid;
+        else hi = mid;
+      }
+      return spine[lo];
+    }
+
+    /* Finds the nearest node after the given chunk whose value is no greater
+     * than value, or NoNode if there is none.
+     */
+    Index FindRightSmaller(size_t chunk, const T& value) const {
+      /* Skip forward over the longest run of chunks whose minima are all
+       * greater than value.
+       */
+      size_t pos = chunk + 1;
+      for (size_t k = minTable.size(); k != 0; --k) {
+        const size_t width = size_t(1) << (k - 1);
+        if (pos + width <= numChunks && comp(value, ValueAt(minTable[k - 1][pos])))
+          pos += width;
+      }
+      if (pos == numChunks) return NoNode<Index>();
+
+      /* The nearest one is the first entry on that chunk's left spine that is
+       * no greater than value.
+       */
+      const std::vector<Index>& spine = leftSpines[pos];
+      size_t lo = 0, hi = spine.size() - 1;
+      while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (comp(value, ValueAt(spine[mid]))) lo = mid + 1;
+        else hi = mid;
+      }
+      return spine[lo];
+    }
+
+    /* Phase 2: resolve the nearest smaller values that lie outside a chunk,
+     * then link each node in the chunk to its parent.  Returns the root if
+     * it lies in this chunk, or NoNode otherwise.
+     */
+    Index LinkChunk(size_t chunk) {
+      const size_t chunkBegin = chunk * chunkSize;
+      const size_t chunkEnd = ChunkEnd(chunk);
+      std::vector< Node<T, Index> >& arena = *nodes;
+      Index root = NoNode<Index>();
+
+      for (size_t i = chunkBegin; i != chunkEnd; ++i) {
+        Index left = leftSmaller[i], right = rightSmaller[i];
+        if (left == NoNode<Index>() && chunk != 0)
+          left = FindLeftSmaller(chunk, arena[i].value);
+        if (right == NoNode<Index>() && chunk + 1 != numChunks)
+          right = FindRightSmaller(chunk, arena[i].value);
+
+        if (left == NoNode<Index>() && right == NoNode<Index>())
+          root = Index(i);
+        else if (right == NoNode<Index>() ||
+                 (left != NoNode<Index>() &&
+                  !comp(arena[left].value, arena[right].value)))
+          arena[left].right = Index(i);
+        else
+          arena[right].left = Index(i);
+      }
+      return root;
+    }
+  };
+
+  /* Tasks running each phase of the parallel builder on a single chunk. */
+  template <typename T, typename Index, typename Comparator>
+  struct ScanChunkTask {
+    ParallelTreeBuilder<T, Index, Comparator>* builder;
+    size_t chunk;
+
+    void operator() () const {
+      builder->ScanChunk(chunk);
+    }
+  };
+
+  template <typename T, typename Index, typename Comparator>
+  struct LinkChunkTask {
+    ParallelTreeBuilder<T, Index, Comparator>* builder;
+    size_t chunk;
+    Index* root;
+
+    void operator() () const {
+      const Index found = builder->LinkChunk(chunk);
+      if (found != NoNode<Index>()) *root = found;
+    }
+  };
+
+  /* void ParallelCartesianTreeSortWithIndex(RandomIterator begin,
+   *                                         RandomIterator end,
+   *                                         Comparator comp,
+   *                                         Executor& executor);
+   * Usage: ParallelCartesianTreeSortWithIndex<uint32_t>(begin, end, comp,
+   *                                                     executor);
+   * -------------------------------------------------------------------------
+   * Counterpart of CartesianTreeSortWithIndex that links the tree in
+   * parallel using the ANSV builder above.  The values are still moved into
+   * and out of the arena sequentially, as is the frontier phase.
+   */
+  template <typename Index, typename RandomIterator, typename Comparator,
+            typename Executor>
+  void ParallelCartesianTreeSortWithIndex(RandomIterator begin,
+                                          RandomIterator end,
+                                          Comparator comp,
+                                          Executor& executor) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Constants controlling the chunking.  Chunks have to be large enough
+     * that their spines are short compared to their length, and there are a
+     * few per thread so that uneven chunks balance out.
+     */
+    const size_t kMinChunkSize = 1 << 14;
+    const size_t kChunksPerThread = 4;
+
+    const size_t numElems = size_t(end - begin);
+
+    /* Move every value into the arena, unlinked. */
+    std::vector< Node<T, Index> > nodes;
+    nodes.reserve(numElems);
+    for (RandomIterator itr = begin; itr != end; ++itr)
+      nodes.emplace_back(std::move(*itr));
+
+    ParallelTreeBuilder<T, Index, Comparator> builder;
+    builder.nodes = &nodes;
+    builder.comp = comp;
+    builder.numChunks = std::max<size_t>(1, std::min(numElems / kMinChunkSize,
+                                                     kChunksPerThread * executor.NumThreads()));
+    builder.chunkSize = (numElems + builder.numChunks - 1) / builder.numChunks;
+    builder.numChunks = (numElems + builder.chunkSize - 1) / builder.chunkSize;
+    builder.leftSmaller.resize(numElems);
+    builder.rightSmaller.resize(numElems);
+    builder.leftSpines.resize(builder.numChunks);
+    builder.rightSpines.resize(builder.numChunks);
+
+    /* Phase 1: scan each chunk. */
+    {
+      TaskGroup<Executor> group(executor);
+      for (size_t chunk = 0; chunk < builder.numChunks; ++chunk) {
+        ScanChunkTask<T, Index, Comparator> task = { &builder, chunk };
+        group.Spawn(task);
+      }
+      group.Wait();
+    }
+
+    builder.BuildMinTable();
+
+    /* Phase 2: link each chunk's nodes to their parents.  Exactly one node
+     * has no parent, so only one task writes the root.
+     */
+    Index root = NoNode<Index>();
+    {
+      TaskGroup<Executor> group(executor);
+      for (size_t chunk = 0; chunk < builder.numChunks; ++chunk) {
+        LinkChunkTask<T, Index, Comparator> task = { &builder, chunk, &root };
+        group.Spawn(task);
+      }
+      group.Wait();
+    }
+
+    /* Move the values back out in sorted order. */
+    MoveSmallestOutOfTree(nodes, root, numElems, begin, comp,
+                          static_cast<std::vector<bool>*>(NULL));
+  }
 }
 
 /* Actual implementation of Cartesian tree sort, using a parameterized
@@ -184,56 +997,317 @@ template <typename ForwardIterator, typename Comparator>
 void CartesianTreeSort(ForwardIterator begin, ForwardIterator end,
                        Comparator comp) {
   /* As an edge case, check if the input is empty.  This avoids a problem
-   * later on in this function where we might try enqueueing a NULL tree node
-   * into the queue.
+   * later on where we might try enqueueing a missing tree node into the
+   * queue.
    */
   if (begin == end) return;
 
   /* Grant access to our helper types and classes. */
   using namespace cartesiantreesort_detail;
 
-  /* Again, for sanity's sake, typedef the type being iterated over. */
-  typedef typename std::iterator_traits<ForwardIterator>::value_type T;
+  /* Use 32-bit node indices whenever they can address every node (keeping
+   * the top value free for NoNode), and full-width indices otherwise.
+   */
+  const size_t numElems = size_t(std::distance(begin, end));
+  if (numElems < size_t(NoNode<uint32_t>()))
+    CartesianTreeSortWithIndex<uint32_t>(begin, end, numElems, comp);
+  else
+    CartesianTreeSortWithIndex<size_t>(begin, end, numElems, comp);
+}
 
-  /* A type representing a priority queue that compares the value fields of
-   * Cartesian tree nodes.
+/* The incremental sorter maintains the same two structures as the batch
+ * sort: a Cartesian tree being built from the incoming values, and a
+ * frontier of exposed roots from which the smallest values are pulled.
+ * Whenever a watermark arrives or the sorter is sealed, the tree built so far
+ * is cut loose and its root handed to the frontier, and a fresh tree is
+ * started for the values that follow.  Every value in the frontier's trees
+ * was pushed before the cut, and every later value is no smaller than the
+ * watermark, so pulling the frontier's minimum is safe whenever that minimum
+ * is no greater than the watermark.  Cutting the tree also means that later
+ * pushes never have to attach below a node that was already pulled.  Pulled
+ * nodes go on a free list and their slots are reused, so memory stays
+ * proportional to the number of values held rather than the number seen.
+ */
+template <typename T, typename Comparator>
+class IncrementalCartesianSorter {
+public:
+  /* Constructor: IncrementalCartesianSorter(Comparator comp = Comparator());
+   * Usage: IncrementalCartesianSorter<int> sorter;
+   * -------------------------------------------------------------------------
+   * Constructs an empty sorter ordering values by the given comparator.
    */
-  typedef std::priority_queue<Node<T>*, std::vector<Node<T>*>,
-                              NodeComparator<T, Comparator> > PQueue;
+  explicit IncrementalCartesianSorter(Comparator comp = Comparator())
+    : comp(comp), frontier(nodes, comp, 0), root(NoNode()), sealed(false) {
+    rightSpine.push_back(NoNode());
+  }
 
-  /* Construct a priority queue, wrapping up the comparator provided by the
-   * client.  Due to the Most Vexing Parse, we have to parenthesize the
-   * argument so this isn't accidentally interpreted as a function declaration.
+  /* void push(const T& value);
+   * void push(T&& value);
+   * Usage: sorter.push(value);
+   * -------------------------------------------------------------------------
+   * Adds a value to the sorter.  The value must not compare less than the
+   * most recent watermark, and the sorter must not have been sealed.
    */
-  PQueue pq((NodeComparator<T, Comparator>(comp)));
+  void push(const T& value) {
+    Insert(value);
+  }
+  void push(T&& value) {
+    Insert(std::move(value));
+  }
 
-  /* Obtain a Cartesian tree over the input.  We'll store the result in a
-   * const auto_ptr to ensure that
-   *
-   * 1. The memory is reclaimed when the function exits and the auto_ptr
-   *    leaves scope.
-   * 2. The memory isn't accidentally transferred elsewhere, because the
-   *    auto_ptr is const.
+  /* void watermark(const T& bound);
+   * Usage: sorter.watermark(bound);
+   * -------------------------------------------------------------------------
+   * Promises that no value pushed from now on will compare less than bound,
+   * making all values no greater than bound available to pull.  Watermarks
+   * lower than an earlier one are ignored.
+   */
+  void watermark(const T& bound) {
+    if (watermarkValue.empty())
+      watermarkValue.push_back(bound);
+    else if (comp(watermarkValue[0], bound))
+      watermarkValue[0] = bound;
+    CutTree();
+  }
+
+  /* void seal();
+   * Usage: sorter.seal();
+   * -------------------------------------------------------------------------
+   * Promises that no more values will be pushed, making every remaining value
+   * available to pull.
+   */
+  void seal() {
+    sealed = true;
+    CutTree();
+  }
+
+  /* bool ready() const;
+   * Usage: while (sorter.ready()) { ... }
+   * -------------------------------------------------------------------------
+   * Returns whether a call to pull() would produce a value.
+   */
+  bool ready() const {
+    if (frontier.empty()) return false;
+    if (sealed) return true;
+    return !watermarkValue.empty() &&
+           !comp(watermarkValue[0], nodes[frontier.top()].value);
+  }
+
+  /* bool pull(T& out);
+   * Usage: for (T value; sorter.pull(value); ) { ... }
+   * -------------------------------------------------------------------------
+   * If a value is ready, moves the smallest remaining value into out and
+   * returns true.  Otherwise, leaves out alone and returns false.
+   */
+  bool pull(T& out) {
+    if (!ready()) return false;
+
+    /* Take the smallest exposed root and expose its children instead. */
+    const size_t curr = frontier.top();
+    frontier.pop();
+    out = std::move(nodes[curr].value);
+    if (nodes[curr].left  != NoNode()) frontier.push(nodes[curr].left);
+    if (nodes[curr].right != NoNode()) frontier.push(nodes[curr].right);
+
+    /* This node's slot can now be reused. */
+    freeNodes.push_back(curr);
+    return true;
+  }
+
+  /* class PullIterator;
+   * Usage: for (IncrementalCartesianSorter<T>::PullIterator itr = sorter.begin();
+   *             itr != sorter.end(); ++itr) { ... }
+   * -------------------------------------------------------------------------
+   * An input iterator that pulls values from the sorter for as long as they
+   * are ready.  Dereferencing gives the value most recently pulled.
+   */
+  class PullIterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef T                       value_type;
+    typedef std::ptrdiff_t          difference_type;
+    typedef T*                      pointer;
+    typedef T&                      reference;
+
+    PullIterator() : sorter(NULL), value() {}
+
+    T& operator* () {
+      return value;
+    }
+    T* operator-> () {
+      return &value;
+    }
+
+    PullIterator& operator++ () {
+      if (!sorter->pull(value))
+        sorter = NULL;
+      return *this;
+    }
+
+    bool operator== (const PullIterator& other) const {
+      return sorter == other.sorter;
+    }
+    bool operator!= (const PullIterator& other) const {
+      return sorter != other.sorter;
+    }
+
+  private:
+    friend class IncrementalCartesianSorter;
+
+    explicit PullIterator(IncrementalCartesianSorter* sorter)
+      : sorter(sorter), value() {
+      ++*this;
+    }
+
+    IncrementalCartesianSorter* sorter; // NULL once nothing is ready
+    T value;                            // The value most recently pulled
+  };
+
+  /* PullIterator begin();
+   * PullIterator end();
+   * Usage: for (PullIterator itr = sorter.begin(); itr != sorter.end(); ++itr)
+   * -------------------------------------------------------------------------
+   * Returns iterators over the values that are ready to be pulled.
    */
-  const std::auto_ptr< Node<T> > tree(MakeCartesianTree(begin, end, comp));
+  PullIterator begin() {
+    return PullIterator(this);
+  }
+  PullIterator end() {
+    return PullIterator();
+  }
 
-  /* Initialize the priority queue to hold the Cartesian tree of the input. */
-  pq.push(tree.get());
+private:
+  typedef cartesiantreesort_detail::Node<T, size_t> Node;
 
-  /* Now, scan across the sequence, placing the smallest known value at the
-   * next open position and updating the queue accordingly.
+  /* Returns the sentinel index for a missing node. */
+  static size_t NoNode() {
+    return cartesiantreesort_detail::NoNode<size_t>();
+  }
+
+  /* Adds a value to the current tree, exactly as MakeCartesianTree does, but
+   * placing the node in a recycled slot if one is free.
    */
-  for (ForwardIterator itr = begin; itr != end; ++itr) {
-    /* Grab the next node from the queue. */
-    Node<T>* curr = pq.top(); pq.pop();
+  template <typename U> void Insert(U&& value) {
+    size_t node;
+    if (freeNodes.empty()) {
+      node = nodes.size();
+      nodes.emplace_back(std::forward<U>(value));
+    } else {
+      node = freeNodes.back();
+      freeNodes.pop_back();
+      nodes[node].value = std::forward<U>(value);
+      nodes[node].left = nodes[node].right = NoNode();
+    }
+
+    /* Walk up the right spine to find the new node's parent. */
+    size_t curr;
+    for (curr = rightSpine.back(); curr != NoNode(); rightSpine.pop_back(), curr = rightSpine.back())
+      if (comp(nodes[curr].value, nodes[node].value))
+        break;
+
+    if (curr == NoNode()) {
+      nodes[node].left = root;
+      root = node;
+    } else {
+      nodes[node].left = nodes[curr].right;
+      nodes[curr].right = node;
+    }
+    rightSpine.push_back(node);
+  }
+
+  /* Hands the tree built so far to the frontier and starts a new one. */
+  void CutTree() {
+    if (root == NoNode()) return;
+
+    frontier.push(root);
+    root = NoNode();
+    rightSpine.resize(1);
+  }
+
+  Comparator comp;                          // Orders the values
+  std::vector<Node> nodes;                  // The arena holding every node
+  std::vector<size_t> freeNodes;            // Slots of nodes already pulled
+  cartesiantreesort_detail::FrontierHeap<T, size_t, Comparator> frontier;
+                                            // Roots of trees being pulled
+  size_t root;                              // Root of the tree being built
+  std::vector<size_t> rightSpine;           // Its right spine, NoNode first
+  std::vector<T> watermarkValue;            // Holds the watermark, if any
+  bool sealed;                              // Whether pushing has ended
+
+  /* The frontier points into the arena, so sorters are neither copyable
+   * nor assignable.
+   */
+  IncrementalCartesianSorter(const IncrementalCartesianSorter&);
+  IncrementalCartesianSorter& operator= (const IncrementalCartesianSorter&);
+};
+
+/* Implementation of the partial sort, using a parameterized comparator. */
+template <typename ForwardIterator, typename Comparator>
+void CartesianTreePartialSort(ForwardIterator begin, ForwardIterator middle,
+                              ForwardIterator end, Comparator comp) {
+  /* Grant access to our helper types and classes. */
+  using namespace cartesiantreesort_detail;
 
-    /* Store its value back into the sequence. */
-    *itr = curr->value;
+  /* If nothing is wanted, there's nothing to do. */
+  if (begin == middle) return;
 
-    /* Add any non-NULL subtrees of the current tree back into the queue. */
-    if (curr->left) pq.push(curr->left);
-    if (curr->right) pq.push(curr->right);
+  /* Choose the index width just as the full sort does. */
+  const size_t numElems = size_t(std::distance(begin, end));
+  if (numElems < size_t(NoNode<uint32_t>()))
+    CartesianTreePartialSortWithIndex<uint32_t>(begin, middle, end,
+                                                numElems, comp);
+  else
+    CartesianTreePartialSortWithIndex<size_t>(begin, middle, end,
+                                              numElems, comp);
+}
+
+/* Implementation of top-k selection, using a parameterized comparator. */
+template <typename ForwardIterator, typename OutputIterator,
+          typename Comparator>
+OutputIterator CartesianTreeTopK(ForwardIterator begin, ForwardIterator end,
+                                 size_t k, OutputIterator out,
+                                 Comparator comp) {
+  /* Grant access to our helper types and classes. */
+  using namespace cartesiantreesort_detail;
+
+  /* Never ask for more values than there are. */
+  const size_t numElems = size_t(std::distance(begin, end));
+  k = std::min(k, numElems);
+  if (k == 0) return out;
+
+  /* Choose the index width just as the full sort does. */
+  if (numElems < size_t(NoNode<uint32_t>()))
+    return CartesianTreeTopKWithIndex<uint32_t>(begin, end, numElems, k,
+                                                out, comp);
+  else
+    return CartesianTreeTopKWithIndex<size_t>(begin, end, numElems, k,
+                                              out, comp);
+}
+
+/* Implementation of parallel Cartesian tree sort. */
+template <typename RandomIterator, typename Comparator, typename Executor>
+void ParallelCartesianTreeSort(RandomIterator begin, RandomIterator end,
+                               Comparator comp, Executor& executor) {
+  /* Grant access to our helper types and classes. */
+  using namespace cartesiantreesort_detail;
+
+  /* Constant controlling the smallest input worth building in parallel. */
+  const size_t kParallelCutoff = 1 << 16;
+
+  /* Small inputs aren't worth the overhead of the tasks, so just sort them
+   * sequentially.
+   */
+  const size_t numElems = size_t(end - begin);
+  if (numElems < kParallelCutoff || executor.NumThreads() < 2) {
+    CartesianTreeSort(begin, end, comp);
+    return;
   }
+
+  /* Choose the index width just as the sequential version does. */
+  if (numElems < size_t(NoNode<uint32_t>()))
+    ParallelCartesianTreeSortWithIndex<uint32_t>(begin, end, comp, executor);
+  else
+    ParallelCartesianTreeSortWithIndex<size_t>(begin, end, comp, executor);
 }
 
 /* Non-comparator version implemented in terms of the comparator version. */
@@ -243,4 +1317,19 @@ void CartesianTreeSort(ForwardIterator begin, ForwardIterator end) {
                     std::less<typename std::iterator_traits<ForwardIterator>::value_type>());
 }
 
+/* Non-comparator versions of the partial sorts. */
+template <typename ForwardIterator>
+void CartesianTreePartialSort(ForwardIterator begin, ForwardIterator middle,
+                              ForwardIterator end) {
+  CartesianTreePartialSort(begin, middle, end,
+                           std::less<typename std::iterator_traits<ForwardIterator>::value_type>());
+}
+
+template <typename ForwardIterator, typename OutputIterator>
+OutputIterator CartesianTreeTopK(ForwardIterator begin, ForwardIterator end,
+                                 size_t k, OutputIterator out) {
+  return CartesianTreeTopK(begin, end, k, out,
+                           std::less<typename std::iterator_traits<ForwardIterator>::value_type>());
+}
+
 #endif // CARTESIANTREESORT_H
@@ -12,6 +12,8 @@
 #include <functional> // For less
 #include <iterator>   // For iterator_traits
 #include <iostream>
+#include <type_traits>
+#include <utility>    // For move
 
 /**
  * Function: Introsort(RandomIterator begin, RandomIterator end);
@@ -32,21 +34,67 @@ void Introsort(RandomIterator begin, RandomIterator end);
 template <typename RandomIterator, typename Comparator>
 void Introsort(RandomIterator begin, RandomIterator end, Comparator comp);
 
+/**
+ * Function: PatternDefeatingSort(RandomIterator begin, RandomIterator end);
+ * Function: PatternDefeatingSort(RandomIterator begin, RandomIterator end,
+ *                                Comparator comp);
+ * -----------------------------------------------------------------------
+ * Sorts the range [begin, end) into ascending order (according to comp,
+ * or the default ordering) using pattern-defeating quicksort, a variant of
+ * introsort that adapts to the structure of its input.  It picks pivots
+ * with a ninther on large ranges, finishes off ranges that a partition
+ * found already in order with a bounded insertion sort, gathers runs of
+ * keys equal to an earlier pivot in a single linear pass, and breaks up
+ * patterns that cause unbalanced partitions by swapping a few elements
+ * around.  Sorted, reverse-sorted, and low-cardinality inputs take close
+ * to linear time, and the heapsort fallback still bounds the worst case
+ * at O(n lg n).
+ */
+template <typename RandomIterator>
+void PatternDefeatingSort(RandomIterator begin, RandomIterator end);
+template <typename RandomIterator, typename Comparator>
+void PatternDefeatingSort(RandomIterator begin, RandomIterator end,
+                          Comparator comp);
+
+/**
+ * Function: ParallelIntrosort(RandomIterator begin, RandomIterator end,
+ *                             Comparator comp, Executor& executor);
+ * Usage: WorkStealingPool pool;
+ *        ParallelIntrosort(v.begin(), v.end(), std::less<int>(), pool);
+ * -----------------------------------------------------------------------
+ * Sorts the range [begin, end) into ascending order (according to comp)
+ * using the introsort algorithm, farming out subranges to the executor.
+ * Each partitioning step hands the smaller of its two subranges to the
+ * executor as a new task while the current thread keeps working on the
+ * larger one.  Once a subrange falls below a size cutoff it is finished
+ * off with the sequential introsort.  Because the depth budget is carried
+ * into every task, the heapsort fallback still guarantees O(n lg n) total
+ * work.  The executor is typically a WorkStealingPool.
+ */
+template <typename RandomIterator, typename Comparator, typename Executor>
+void ParallelIntrosort(RandomIterator begin, RandomIterator end,
+                       Comparator comp, Executor& executor);
+
 /* * * * * Implementation Below This Point * * * * */
+#include "simdpartition.h"
+#include "smallsort.h"
+#include "workstealingpool.h"
+
 namespace introsort_detail {
   /**
    * Function: Partition(RandomIterator begin, RandomIterator end,
-   *                     Comparator comp);
-   * Usage: Partition(begin, end, comp);
+   *                     Comparator comp, std::false_type);
+   * Usage: Partition(begin, end, comp, std::false_type());
    * -------------------------------------------------------------
    * Applies the partition algorithm to the range [begin, end),
    * assuming that the pivot element is pointed at by begin.
    * Comparisons are performed using comp.  Returns an iterator
-   * to the final position of the pivot element.
+   * to the final position of the pivot element.  This version
+   * works for any element type and comparator.
    */
   template <typename RandomIterator, typename Comparator>
   RandomIterator Partition(RandomIterator begin, RandomIterator end,
-                           Comparator comp) {
+                           Comparator comp, std::false_type) {
     /* The following algorithm for doing an in-place partition is
      * one of the most efficient partitioning algorithms.  It works
      * by maintaining two pointers, one on the left-hand side of
@@ -97,6 +145,186 @@ namespace introsort_detail {
     return lhs;
   }
 
+  /**
+   * Function: Partition(RandomIterator begin, RandomIterator end,
+   *                     Comparator comp, std::true_type);
+   * Usage: Partition(begin, end, comp, std::true_type());
+   * -------------------------------------------------------------
+   * Applies the partition algorithm to the range [begin, end),
+   * exactly like the version above, but without branching on the
+   * results of comparisons.  When the keys are random, the scans in
+   * the version above go one way or the other at random, and the
+   * processor mispredicts about half of those branches.
+   *
+   * Instead, this version (BlockQuicksort, due to Edelkamp and
+   * Weiss) works a block at a time from each end.  For each block,
+   * it records the offsets of the elements that are on the wrong
+   * side in a small buffer, writing every offset and advancing the
+   * buffer's length by the comparison's result, so that the loop
+   * has no data-dependent branches.  Then it swaps pairs of
+   * misplaced elements from the two buffers in bulk.  Once the
+   * unpartitioned middle is too small for two blocks, it's finished
+   * off with the usual scans.
+   *
+   * This only pays off when comparisons are cheap and compile to
+   * branch-free code, so it's used just for arithmetic types with
+   * the standard comparators.
+   */
+  template <typename RandomIterator, typename Comparator>
+  RandomIterator Partition(RandomIterator begin, RandomIterator end,
+                           Comparator comp, std::true_type) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Constant controlling how many elements are examined from each end
+     * at a time.  The offsets have to fit in an unsigned char.
+     */
+    const size_t kBlockSize = 64;
+
+    /* The pivot is a cheap arithmetic value, so copy it somewhere that
+     * won't be swapped around.
+     */
+    const T pivot = *begin;
+
+    /* Everything before lhs is known to be less than the pivot, and
+     * everything from rhs on is known to be no less than it.
+     */
+    RandomIterator lhs = begin + 1;
+    RandomIterator rhs = end;
+
+    /* Offsets of the misplaced elements of the current block at each end,
+     * measured from lhs on the left and back from rhs on the right, along
+     * with how many are left to be swapped and where they start.
+     */
+    unsigned char leftOffsets[kBlockSize];
+    unsigned char rightOffsets[kBlockSize];
+    size_t numLeft = 0, numRight = 0;
+    size_t startLeft = 0, startRight = 0;
+
+    while (size_t(rhs - lhs) > 2 * kBlockSize) {
+      /* Refill whichever buffers are empty.  Every offset is written, but
+       * the length only grows for elements on the wrong side.
+       */
+      if (numLeft == 0) {
+        startLeft = 0;
+        for (size_t i = 0; i < kBlockSize; ++i) {
+          leftOffsets[numLeft] = static_cast<unsigned char>(i);
+          numLeft += !comp(lhs[i], pivot);
+        }
+      }
+      if (numRight == 0) {
+        startRight = 0;
+        for (size_t i = 0; i < kBlockSize; ++i) {
+          rightOffsets[numRight] = static_cast<unsigned char>(i + 1);
+          numRight += comp(*(rhs - (i + 1)), pivot);
+        }
+      }
+
+      /* Swap as many misplaced pairs as we can. */
+      const size_t numSwaps = std::min(numLeft, numRight);
+      for (size_t i = 0; i < numSwaps; ++i)
+        std::iter_swap(lhs + leftOffsets[startLeft + i],
+                       rhs - rightOffsets[startRight + i]);
+      numLeft -= numSwaps;  startLeft  += numSwaps;
+      numRight -= numSwaps; startRight += numSwaps;
+
+      /* Any block with no misplaced elements left is done. */
+      if (numLeft == 0)  lhs += kBlockSize;
+      if (numRight == 0) rhs -= kBlockSize;
+    }
+
+    /* Finish off what's left, including any half-processed block, with
+     * ordinary scans.
+     */
+    while (true) {
+      while (lhs < rhs && comp(*lhs, pivot))
+        ++lhs;
+      while (lhs < rhs && !comp(*(rhs - 1), pivot))
+        --rhs;
+      if (lhs == rhs) break;
+
+      std::iter_swap(lhs, rhs - 1);
+      ++lhs;
+      --rhs;
+    }
+
+    /* The last element less than the pivot (if any) trades places with
+     * the pivot.
+     */
+    RandomIterator pivotPos = lhs - 1;
+    std::iter_swap(begin, pivotPos);
+    return pivotPos;
+  }
+
+  /* A type trait that determines whether Partition can use the vectorized
+   * partition.  This needs a contiguous array of a primitive key type that
+   * SimdPartition handles, sorted in ascending order.
+   */
+  template <typename RandomIterator, typename Comparator>
+  struct IsSimdPartitionable {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+    static const bool value = simdpartition_detail::IsContiguousIterator<RandomIterator>::value &&
+                              std::is_same<Comparator, std::less<T> >::value &&
+                              simdpartition_detail::KeyKindOf<T>::value !=
+                              simdpartition_detail::kUnsupportedKey;
+  };
+
+  /**
+   * Function: Partition(RandomIterator begin, RandomIterator end,
+   *                     Comparator comp, std::true_type, std::true_type);
+   * Usage: Partition(begin, end, comp, std::true_type(), std::true_type());
+   * -------------------------------------------------------------
+   * Applies the partition algorithm to the range [begin, end),
+   * exactly like the versions above, but using SimdPartition on the
+   * underlying array when the processor has the vector instructions it
+   * needs.  Otherwise, it falls back on the block partition.
+   */
+  template <typename RandomIterator, typename Comparator>
+  RandomIterator Partition(RandomIterator begin, RandomIterator end,
+                           Comparator comp, std::true_type, std::true_type) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    if (!SimdPartitionSupported())
+      return Partition(begin, end, comp, std::true_type());
+
+    /* Split everything after the pivot, then swap the pivot with the last
+     * element less than it, just as the other versions do.
+     */
+    T* first = &*begin;
+    T* split = SimdPartition(first + 1, first + (end - begin), *first);
+    RandomIterator pivotPos = begin + ((split - first) - 1);
+    std::iter_swap(begin, pivotPos);
+    return pivotPos;
+  }
+
+  template <typename RandomIterator, typename Comparator, typename Blockable>
+  RandomIterator Partition(RandomIterator begin, RandomIterator end,
+                           Comparator comp, Blockable blockable,
+                           std::false_type) {
+    return Partition(begin, end, comp, blockable);
+  }
+
+  /**
+   * Function: Partition(RandomIterator begin, RandomIterator end,
+   *                     Comparator comp);
+   * Usage: Partition(begin, end, comp);
+   * -------------------------------------------------------------
+   * Applies the partition algorithm to the range [begin, end),
+   * assuming that the pivot element is pointed at by begin.
+   * Comparisons are performed using comp.  Returns an iterator
+   * to the final position of the pivot element.  Contiguous arrays
+   * of primitive keys in ascending order use the vectorized
+   * partition, and other arithmetic types under the standard
+   * comparators use the block partition.
+   */
+  template <typename RandomIterator, typename Comparator>
+  RandomIterator Partition(RandomIterator begin, RandomIterator end,
+                           Comparator comp) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+    return Partition(begin, end, comp,
+                     smallsort_detail::HasBranchlessCompare<T, Comparator>(),
+                     std::integral_constant<bool, IsSimdPartitionable<RandomIterator, Comparator>::value>());
+  }
+
   /**
    * Function: MedianOfThree(RandomIterator one, RandomIterator two,
    *                         RandomIterator three, Comparator comp);
@@ -120,52 +348,232 @@ namespace introsort_detail {
     return two;                                     // 3 <= 2 <= 1
   }
 
+  /**
+   * Function: UnguardedInsertionSort(RandomIterator begin,
+   *                                  RandomIterator end, Comparator comp);
+   * ----------------------------------------------------------------------
+   * Sorts the range [begin, end) using insertion sort, assuming that the
+   * element just before begin is no greater than any element of the range.
+   * That element acts as a sentinel that stops every shift, so the inner
+   * loop never has to check whether it has reached the beginning.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void UnguardedInsertionSort(RandomIterator begin, RandomIterator end,
+                              Comparator comp) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    if (begin == end) return;
+
+    for (RandomIterator itr = begin + 1; itr != end; ++itr) {
+      if (!comp(*itr, *(itr - 1))) continue;
+
+      /* Shift larger elements up into the hole, relying on the sentinel. */
+      T value(std::move(*itr));
+      RandomIterator hole = itr;
+      do {
+        *hole = std::move(*(hole - 1));
+        --hole;
+      } while (comp(value, *(hole - 1)));
+      *hole = std::move(value);
+    }
+  }
+
+  /**
+   * Function: SortLeaf(RandomIterator begin, RandomIterator end,
+   *                    Comparator comp, bool leftmost);
+   * ----------------------------------------------------------------------
+   * Sorts a range too small to be worth partitioning.  For arithmetic
+   * types under the standard comparators, this runs the branch-free
+   * sorting network for the range's size.  Otherwise, it uses insertion
+   * sort, which can skip the bounds check if the range isn't leftmost.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void SortLeaf(RandomIterator begin, RandomIterator end, Comparator comp,
+                bool leftmost, std::false_type) {
+    if (leftmost) smallsort_detail::InsertionSort(begin, end, comp);
+    else UnguardedInsertionSort(begin, end, comp);
+  }
+
+  template <typename RandomIterator, typename Comparator>
+  void SortLeaf(RandomIterator begin, RandomIterator end, Comparator comp,
+                bool, std::true_type) {
+    SmallSort(begin, end, comp);
+  }
+
+  template <typename RandomIterator, typename Comparator>
+  void SortLeaf(RandomIterator begin, RandomIterator end, Comparator comp,
+                bool leftmost) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+    SortLeaf(begin, end, comp, leftmost,
+             smallsort_detail::HasBranchlessCompare<T, Comparator>());
+  }
+
+  /**
+   * Function: ThreeWayPartition(RandomIterator begin, RandomIterator end,
+   *                             Comparator comp,
+   *                             RandomIterator& equalBegin,
+   *                             RandomIterator& equalEnd);
+   * ---------------------------------------------------------------
+   * Partitions the range [begin, end) into three parts around the
+   * pivot element pointed at by begin, using Dijkstra's Dutch
+   * national flag algorithm.  Afterwards, the elements less than the
+   * pivot are in [begin, equalBegin), the elements equivalent to it
+   * are in [equalBegin, equalEnd), and the elements greater than it
+   * are in [equalEnd, end).  The middle range is already in its final
+   * position, so none of it needs to be looked at again.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void ThreeWayPartition(RandomIterator begin, RandomIterator end,
+                         Comparator comp, RandomIterator& equalBegin,
+                         RandomIterator& equalEnd) {
+    /* The pivot stays put at begin until the very end.  Meanwhile, the
+     * elements in [begin + 1, less) are less than it, the ones in
+     * [less, itr) are equivalent to it, the ones in [itr, greater) haven't
+     * been looked at yet, and the ones in [greater, end) are greater.
+     */
+    RandomIterator less = begin + 1;
+    RandomIterator itr = begin + 1;
+    RandomIterator greater = end;
+    while (itr < greater) {
+      if (comp(*itr, *begin)) {
+        std::iter_swap(itr, less);
+        ++less;
+        ++itr;
+      } else if (comp(*begin, *itr)) {
+        --greater;
+        std::iter_swap(itr, greater);
+      } else {
+        ++itr;
+      }
+    }
+
+    /* Move the pivot to the front of the equivalent range by swapping it
+     * with the last element that's less than it.
+     */
+    --less;
+    std::iter_swap(begin, less);
+    equalBegin = less;
+    equalEnd = greater;
+  }
+
+  /**
+   * Function: PartitionAroundMedian(RandomIterator begin, RandomIterator end,
+   *                                 Comparator comp,
+   *                                 RandomIterator& lessEnd,
+   *                                 RandomIterator& greaterBegin);
+   * ---------------------------------------------------------------
+   * Picks a pivot for [begin, end) with a median-of-three and
+   * partitions the range around it, storing the end of the part that
+   * still needs sorting on the left in lessEnd and the start of the
+   * part that still needs sorting on the right in greaterBegin.
+   *
+   * If the median equals one of the other two samples, the range
+   * probably has many duplicate keys, so it's split three ways and
+   * everything equivalent to the pivot is left out of both sides.
+   * Otherwise, it's split two ways with Partition, and only the pivot
+   * itself is left out.  On inputs with few distinct keys, the
+   * three-way splits consume whole runs of equal keys at once, rather
+   * than splitting them in half over and over until the depth budget
+   * runs out.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void PartitionAroundMedian(RandomIterator begin, RandomIterator end,
+                             Comparator comp, RandomIterator& lessEnd,
+                             RandomIterator& greaterBegin) {
+    /* Use a median-of-three to pick a (hopefully) good pivot. */
+    RandomIterator first  = begin;
+    RandomIterator middle = begin + (end - begin) / 2;
+    RandomIterator last   = end - 1;
+    RandomIterator pivot  = MedianOfThree(first, middle, last, comp);
+
+    /* If two of the samples are equivalent, then the median is equivalent
+     * to both of them, so it suffices to compare the median against the
+     * other two samples.
+     */
+    bool duplicates = false;
+    if (pivot != first)
+      duplicates = duplicates || (!comp(*first, *pivot) && !comp(*pivot, *first));
+    if (pivot != last)
+      duplicates = duplicates || (!comp(*last, *pivot) && !comp(*pivot, *last));
+
+    /* Swap the pivot in place and partition around it. */
+    std::iter_swap(pivot, begin);
+    if (duplicates) {
+      ThreeWayPartition(begin, end, comp, lessEnd, greaterBegin);
+    } else {
+      lessEnd = Partition(begin, end, comp);
+      greaterBegin = lessEnd + 1;
+    }
+  }
+
   /**
    * Function: IntrosortRec(RandomIterator begin, RandomIterator end,
-   *                        size_t depth, Comparator comp);
+   *                        size_t depth, Comparator comp, bool leftmost);
    * ---------------------------------------------------------------------
    * Uses the introsort logic (hybridized quicksort and heapsort) to
-   * sort the range [begin, end) into ascending order by comp.
+   * sort the range [begin, end) into ascending order by comp.  Only the
+   * smaller side of each partition is handled by a recursive call; the
+   * larger side is handled by looping, so the recursion never goes more
+   * than lg n calls deep, however the depth budget is spent.
+   *
+   * Ranges smaller than a block are sorted on the spot with SortLeaf,
+   * while they're still in cache.  leftmost says whether the range starts at
+   * the beginning of the whole input.  If it doesn't, the element just
+   * before it is a former pivot (or a copy of one) that's no greater than
+   * anything in the range, and the insertion sort uses that element as a
+   * sentinel instead of checking bounds.
    */
   template <typename RandomIterator, typename Comparator>
   void IntrosortRec(RandomIterator begin, RandomIterator end,
-                    size_t depth, Comparator comp) {
-    /* Constant controlling the minimum size of a range to sort.  Increasing
-     * this value reduces the amount of recursion performed, but may increase
-     * the final runtime by increasing the time it takes insertion sort to
-     * fix up the sequence.
+                    size_t depth, Comparator comp, bool leftmost) {
+    /* Constant controlling the minimum size of a range to partition.
+     * Increasing this value reduces the amount of recursion performed, but
+     * makes each insertion sort of the leftover ranges take longer.
      */
     const size_t kBlockSize = 24;
 
-    /* Cache how many elements there are. */
-    const size_t numElems = size_t(end - begin);
-
-    /* If there are fewer elements in the range than the block size, we're
-     * done.
-     */
-    if (numElems < kBlockSize) return;
+    while (true) {
+      /* Cache how many elements there are. */
+      const size_t numElems = size_t(end - begin);
 
-    /* If the depth is zero, sort everything using heapsort, then bail out. */
-    if (depth == 0) {
-      std::make_heap(begin, end, comp);
-      std::sort_heap(begin, end, comp);
-      return;
-    }
+      /* If there are fewer elements in the range than the block size,
+       * sort them directly and we're done.
+       */
+      if (numElems < kBlockSize) {
+        SortLeaf(begin, end, comp, leftmost);
+        return;
+      }
 
-    /* Otherwise, use a median-of-three to pick a (hopefully) good pivot,
-     * and partition the input with it.
-     */
-    RandomIterator pivot = MedianOfThree(begin,                // First elem
-                                         begin + numElems / 2, // Middle elem
-                                         end - 1, comp);       // Last elem
+      /* If the depth is zero, sort everything using heapsort, then bail
+       * out.
+       */
+      if (depth == 0) {
+        std::make_heap(begin, end, comp);
+        std::sort_heap(begin, end, comp);
+        return;
+      }
 
-    /* Swap the pivot in place. */
-    std::iter_swap(pivot, begin);
+      /* Otherwise, pick a pivot and partition the input with it.  Both
+       * sides are one level deeper.
+       */
+      RandomIterator lessEnd, greaterBegin;
+      PartitionAroundMedian(begin, end, comp, lessEnd, greaterBegin);
+      --depth;
 
-    /* Get the partition point and sort both halves. */
-    RandomIterator partitionPoint = Partition(begin, end, comp);
-    IntrosortRec(begin, partitionPoint, depth - 1, comp);
-    IntrosortRec(partitionPoint + 1, end, depth - 1, comp);
+      /* Recursively sort the smaller side, then loop around to sort the
+       * larger one.  The smaller side has at most half the elements, which
+       * is what bounds the recursion depth.  The right side is never
+       * leftmost, since the pivot sits just before it.
+       */
+      if (lessEnd - begin < end - greaterBegin) {
+        IntrosortRec(begin, lessEnd, depth, comp, leftmost);
+        begin = greaterBegin;
+        leftmost = false;
+      } else {
+        IntrosortRec(greaterBegin, end, depth, comp, false);
+        end = lessEnd;
+      }
+    }
   }
 
   /**
@@ -189,31 +597,356 @@ namespace introsort_detail {
   }
 
   /**
-   * Function: InsertionSort(RandomIterator begin, RandomIterator end,
+   * Function: PartialInsertionSort(RandomIterator begin, RandomIterator end,
+   *                                Comparator comp);
+   * ----------------------------------------------------------------------
+   * Attempts to sort the range [begin, end) using insertion sort, giving up
+   * once more than a small, fixed number of elements have had to be moved.
+   * Returns whether the range ended up sorted.  This finishes off ranges
+   * that are already sorted or very nearly so in linear time, without
+   * risking quadratic time on ranges that aren't.
+   */
+  template <typename RandomIterator, typename Comparator>
+  bool PartialInsertionSort(RandomIterator begin, RandomIterator end,
+                            Comparator comp) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Constant controlling how many element moves we'll pay for before
+     * deciding the range isn't nearly sorted after all.
+     */
+    const size_t kPartialInsertionSortLimit = 8;
+
+    if (begin == end) return true;
+
+    size_t numMoved = 0;
+    for (RandomIterator itr = begin + 1; itr != end; ++itr) {
+      if (numMoved > kPartialInsertionSortLimit) return false;
+      if (!comp(*itr, *(itr - 1))) continue;
+
+      T value(std::move(*itr));
+      RandomIterator hole = itr;
+      do {
+        *hole = std::move(*(hole - 1));
+        --hole;
+      } while (hole != begin && comp(value, *(hole - 1)));
+      *hole = std::move(value);
+      numMoved += size_t(itr - hole);
+    }
+    return true;
+  }
+
+  /**
+   * Function: Sort3(RandomIterator one, RandomIterator two,
+   *                 RandomIterator three, Comparator comp);
+   * ---------------------------------------------------------------
+   * Swaps the three elements around so that *one <= *two <= *three.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void Sort3(RandomIterator one, RandomIterator two, RandomIterator three,
+             Comparator comp) {
+    if (comp(*two, *one)) std::iter_swap(one, two);
+    if (comp(*three, *two)) {
+      std::iter_swap(two, three);
+      if (comp(*two, *one)) std::iter_swap(one, two);
+    }
+  }
+
+  /**
+   * Function: PartitionRight(RandomIterator begin, RandomIterator end,
+   *                          Comparator comp, bool& alreadyPartitioned);
+   * ----------------------------------------------------------------------
+   * Partitions [begin, end) around the pivot at begin, placing elements
+   * less than the pivot before it and the rest after it, and returns the
+   * pivot's final position.  The scans rely on there being an element no
+   * less than the pivot somewhere after begin, which the pivot selection
+   * guarantees, so they don't bounds-check.  alreadyPartitioned is set if
+   * no elements needed to be exchanged.
+   */
+  template <typename RandomIterator, typename Comparator>
+  RandomIterator PartitionRight(RandomIterator begin, RandomIterator end,
+                                Comparator comp, bool& alreadyPartitioned) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Take the pivot out so that it isn't moved around by the swaps. */
+    T pivot(std::move(*begin));
+    RandomIterator lhs = begin;
+    RandomIterator rhs = end;
+
+    /* Find the first element no less than the pivot. */
+    while (comp(*++lhs, pivot))
+      ;
+
+    /* Find the last element less than the pivot.  If the scan above didn't
+     * move, nothing guarantees that there is one, so check bounds.
+     */
+    if (lhs - 1 == begin)
+      while (lhs < rhs && !comp(*--rhs, pivot))
+        ;
+    else
+      while (!comp(*--rhs, pivot))
+        ;
+
+    /* If the scans crossed without finding a mismatched pair, the range was
+     * already partitioned.
+     */
+    alreadyPartitioned = lhs >= rhs;
+
+    /* Exchange mismatched pairs until the scans cross.  Each scan now has a
+     * sentinel from the previous exchange.
+     */
+    while (lhs < rhs) {
+      std::iter_swap(lhs, rhs);
+      while (comp(*++lhs, pivot))
+        ;
+      while (!comp(*--rhs, pivot))
+        ;
+    }
+
+    /* Put the pivot into its final position. */
+    RandomIterator pivotPos = lhs - 1;
+    *begin = std::move(*pivotPos);
+    *pivotPos = std::move(pivot);
+    return pivotPos;
+  }
+
+  /**
+   * Function: PartitionLeft(RandomIterator begin, RandomIterator end,
    *                         Comparator comp);
    * ----------------------------------------------------------------------
-   * Sorts the range [begin, end) into ascending order (according to comp)
-   * using insertion sort.
+   * Partitions [begin, end) around the pivot at begin like PartitionRight,
+   * except that elements equal to the pivot are placed before it.  This is
+   * used when the pivot is known to equal the element just before the
+   * range, which means no element of the range is smaller than it, so all
+   * the elements equal to it end up on the left and need no more sorting.
    */
   template <typename RandomIterator, typename Comparator>
-  void InsertionSort(RandomIterator begin, RandomIterator end,
-                     Comparator comp) {
-    /* Edge case check - if there are no elements or exactly one element,
-     * we're done.
+  RandomIterator PartitionLeft(RandomIterator begin, RandomIterator end,
+                               Comparator comp) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    T pivot(std::move(*begin));
+    RandomIterator lhs = begin;
+    RandomIterator rhs = end;
+
+    /* Mirror image of PartitionRight: find the last element no greater than
+     * the pivot, then the first element greater than it.
      */
-    if (begin == end || begin + 1 == end) return;
+    while (comp(pivot, *--rhs))
+      ;
+    if (rhs + 1 == end)
+      while (lhs < rhs && !comp(pivot, *++lhs))
+        ;
+    else
+      while (!comp(pivot, *++lhs))
+        ;
+
+    while (lhs < rhs) {
+      std::iter_swap(lhs, rhs);
+      while (comp(pivot, *--rhs))
+        ;
+      while (!comp(pivot, *++lhs))
+        ;
+    }
+
+    RandomIterator pivotPos = rhs;
+    *begin = std::move(*pivotPos);
+    *pivotPos = std::move(pivot);
+    return pivotPos;
+  }
 
-    /* Starting at the second element and continuing rightward, put each
-     * element in its proper position.
+  /**
+   * Function: BreakPatterns(RandomIterator begin, RandomIterator end);
+   * ----------------------------------------------------------------------
+   * Swaps a few elements near the ends of [begin, end) with elements a
+   * quarter of the way in.  This is done to both sides of an unbalanced
+   * partition, so that whatever pattern in the input fooled the pivot
+   * selection is unlikely to fool it again.
+   */
+  template <typename RandomIterator>
+  void BreakPatterns(RandomIterator begin, RandomIterator end) {
+    const size_t kInsertionSortThreshold = 24;
+    const size_t kNintherThreshold = 128;
+
+    const size_t numElems = size_t(end - begin);
+    if (numElems < kInsertionSortThreshold) return;
+
+    const size_t quarter = numElems / 4;
+    std::iter_swap(begin, begin + quarter);
+    std::iter_swap(end - 1, end - quarter);
+    if (numElems > kNintherThreshold) {
+      std::iter_swap(begin + 1, begin + (quarter + 1));
+      std::iter_swap(begin + 2, begin + (quarter + 2));
+      std::iter_swap(end - 2, end - (quarter + 1));
+      std::iter_swap(end - 3, end - (quarter + 2));
+    }
+  }
+
+  /**
+   * Function: PatternDefeatingSortRec(RandomIterator begin,
+   *                                   RandomIterator end, Comparator comp,
+   *                                   size_t badAllowed, bool leftmost);
+   * ---------------------------------------------------------------------
+   * Sorts the range [begin, end) using pattern-defeating quicksort.
+   * badAllowed is the number of highly unbalanced partitions that may
+   * still happen before falling back to heapsort, and leftmost says
+   * whether the range starts at the beginning of the whole input.  If it
+   * doesn't, the element just before begin is no greater than anything in
+   * the range, which both the equal-key check and the unguarded insertion
+   * sort rely on.  As in IntrosortRec, only the smaller side of each
+   * partition is sorted recursively.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void PatternDefeatingSortRec(RandomIterator begin, RandomIterator end,
+                               Comparator comp, size_t badAllowed,
+                               bool leftmost) {
+    /* Constants controlling the size below which we switch to insertion
+     * sort, and the size above which we pick the pivot with a ninther.
      */
-    for (RandomIterator itr = begin + 1; itr != end; ++itr) {
-      /* Continue swapping down until we hit the beginning or are in the
-       * correct position.
+    const size_t kInsertionSortThreshold = 24;
+    const size_t kNintherThreshold = 128;
+
+    while (true) {
+      const size_t numElems = size_t(end - begin);
+
+      /* Sort small ranges directly.  If they're insertion sorted, only the
+       * leftmost range lacks a sentinel before it.
        */
-      for (RandomIterator test = itr; test != begin && comp(*test, *(test - 1)); --test)
-        std::iter_swap(test, test - 1);
+      if (numElems < kInsertionSortThreshold) {
+        SortLeaf(begin, end, comp, leftmost);
+        return;
+      }
+
+      /* Move the pivot to begin.  On large ranges, it's the median of the
+       * medians of three triples (the ninther); otherwise, it's the median
+       * of three.  Either way, the sorting of the samples leaves an element
+       * no less than the pivot after it, which PartitionRight relies on.
+       */
+      const size_t half = numElems / 2;
+      if (numElems > kNintherThreshold) {
+        Sort3(begin, begin + half, end - 1, comp);
+        Sort3(begin + 1, begin + (half - 1), end - 2, comp);
+        Sort3(begin + 2, begin + (half + 1), end - 3, comp);
+        Sort3(begin + (half - 1), begin + half, begin + (half + 1), comp);
+        std::iter_swap(begin, begin + half);
+      } else {
+        Sort3(begin + half, begin, end - 1, comp);
+      }
+
+      /* If the pivot equals the element before the range (which is no
+       * greater than anything in it), then every element equal to the pivot
+       * can be gathered on the left and skipped.  This makes ranges with
+       * many equal keys take linear time.
+       */
+      if (!leftmost && !comp(*(begin - 1), *begin)) {
+        begin = PartitionLeft(begin, end, comp) + 1;
+        continue;
+      }
+
+      /* Partition as usual. */
+      bool alreadyPartitioned;
+      RandomIterator pivotPos = PartitionRight(begin, end, comp,
+                                               alreadyPartitioned);
+      const size_t leftSize  = size_t(pivotPos - begin);
+      const size_t rightSize = size_t(end - (pivotPos + 1));
+
+      if (leftSize < numElems / 8 || rightSize < numElems / 8) {
+        /* The partition was highly unbalanced.  If this keeps happening,
+         * fall back to heapsort; otherwise, shuffle both sides a little.
+         */
+        if (--badAllowed == 0) {
+          std::make_heap(begin, end, comp);
+          std::sort_heap(begin, end, comp);
+          return;
+        }
+        BreakPatterns(begin, pivotPos);
+        BreakPatterns(pivotPos + 1, end);
+      } else if (alreadyPartitioned &&
+                 PartialInsertionSort(begin, pivotPos, comp) &&
+                 PartialInsertionSort(pivotPos + 1, end, comp)) {
+        /* The partition was balanced and nothing was out of place, so the
+         * range may well be sorted already.  If so, we're done.
+         */
+        return;
+      }
+
+      /* Recursively sort the smaller side and loop on the larger one. */
+      if (leftSize < rightSize) {
+        PatternDefeatingSortRec(begin, pivotPos, comp, badAllowed, leftmost);
+        begin = pivotPos + 1;
+        leftmost = false;
+      } else {
+        PatternDefeatingSortRec(pivotPos + 1, end, comp, badAllowed, false);
+        end = pivotPos;
+      }
     }
   }
+
+  /* Forward declaration of the task type used by ParallelIntrosortRec. */
+  template <typename RandomIterator, typename Comparator, typename Executor>
+  struct ParallelIntrosortTask;
+
+  /**
+   * Function: ParallelIntrosortRec(RandomIterator begin, RandomIterator end,
+   *                                size_t depth, Comparator comp,
+   *                                bool leftmost,
+   *                                TaskGroup<Executor>& group);
+   * ---------------------------------------------------------------------
+   * Parallel counterpart of IntrosortRec.  Ranges at least kParallelCutoff
+   * long are partitioned here; the smaller side is spawned into the task
+   * group and the larger side is processed by this loop.  Anything smaller
+   * is handed off to the sequential introsort, which leaves it fully
+   * sorted.
+   */
+  template <typename RandomIterator, typename Comparator, typename Executor>
+  void ParallelIntrosortRec(RandomIterator begin, RandomIterator end,
+                            size_t depth, Comparator comp, bool leftmost,
+                            TaskGroup<Executor>& group) {
+    /* Constant controlling the minimum size of a range that is worth
+     * splitting into parallel tasks.  Below this, the cost of queueing a
+     * task outweighs the work it saves.
+     */
+    const size_t kParallelCutoff = 1 << 14;
+
+    while (size_t(end - begin) >= kParallelCutoff && depth != 0) {
+      /* Pick a pivot and partition exactly as IntrosortRec does. */
+      RandomIterator lessEnd, greaterBegin;
+      PartitionAroundMedian(begin, end, comp, lessEnd, greaterBegin);
+      --depth;
+
+      /* Spawn the smaller range and keep the larger one for ourselves. */
+      ParallelIntrosortTask<RandomIterator, Comparator, Executor> task =
+        { begin, end, depth, comp, leftmost, &group };
+      if (lessEnd - begin < end - greaterBegin) {
+        task.end = lessEnd;
+        begin = greaterBegin;
+        leftmost = false;
+      } else {
+        task.begin = greaterBegin;
+        task.leftmost = false;
+        end = lessEnd;
+      }
+      group.Spawn(task);
+    }
+
+    /* Finish this leaf off sequentially.  If the depth budget ran out, this
+     * call falls straight through to heapsort.
+     */
+    IntrosortRec(begin, end, depth, comp, leftmost);
+  }
+
+  /* A task that runs ParallelIntrosortRec on a subrange. */
+  template <typename RandomIterator, typename Comparator, typename Executor>
+  struct ParallelIntrosortTask {
+    RandomIterator begin, end;
+    size_t depth;
+    Comparator comp;
+    bool leftmost;
+    TaskGroup<Executor>* group;
+
+    void operator() () const {
+      ParallelIntrosortRec(begin, end, depth, comp, leftmost, *group);
+    }
+  };
 }
 
 /* Implementation of introsort. */
@@ -223,12 +956,43 @@ void Introsort(RandomIterator begin, RandomIterator end, Comparator comp) {
   using namespace introsort_detail;
 
   /* Fire off a recursive call to introsort using the depth estimate of
-   * 2 lg (|end - begin|), as suggested in the original paper.
+   * 2 lg (|end - begin|), as suggested in the original paper.  Every small
+   * range is insertion sorted as the recursion reaches it, so nothing is
+   * left to clean up afterwards.
    */
-  IntrosortRec(begin, end, IntrosortDepth(begin, end), comp);
+  IntrosortRec(begin, end, IntrosortDepth(begin, end), comp, true);
+}
 
-  /* Use insertion sort to clean everything else up. */
-  InsertionSort(begin, end, comp);
+/* Implementation of pattern-defeating quicksort. */
+template <typename RandomIterator, typename Comparator>
+void PatternDefeatingSort(RandomIterator begin, RandomIterator end,
+                          Comparator comp) {
+  /* Give easy access to the utility functions. */
+  using namespace introsort_detail;
+
+  if (begin == end) return;
+
+  /* Allow lg(|end - begin|) bad partitions before falling back to heapsort.
+   * IntrosortDepth is twice that.
+   */
+  PatternDefeatingSortRec(begin, end, comp, IntrosortDepth(begin, end) / 2,
+                          true);
+}
+
+/* Implementation of parallel introsort. */
+template <typename RandomIterator, typename Comparator, typename Executor>
+void ParallelIntrosort(RandomIterator begin, RandomIterator end,
+                       Comparator comp, Executor& executor) {
+  /* Give easy access to the utility functions. */
+  using namespace introsort_detail;
+
+  /* Run the parallel recursion with the same depth estimate as the
+   * sequential version, then wait for every spawned subrange to finish.
+   */
+  TaskGroup<Executor> group(executor);
+  ParallelIntrosortRec(begin, end, IntrosortDepth(begin, end), comp, true,
+                       group);
+  group.Wait();
 }
 
 /* Non-comparator version calls the comparator version. */
@@ -238,4 +1002,11 @@ void Introsort(RandomIterator begin, RandomIterator end) {
             std::less<typename std::iterator_traits<RandomIterator>::value_type>());
 }
 
+/* Non-comparator version calls the comparator version. */
+template <typename RandomIterator>
+void PatternDefeatingSort(RandomIterator begin, RandomIterator end) {
+  PatternDefeatingSort(begin, end,
+                       std::less<typename std::iterator_traits<RandomIterator>::value_type>());
+}
+
 #endif // INTROSORT_H
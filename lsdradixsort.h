@@ -0,0 +1,130 @@
+/**
+ * @headerfile lsdradixsort.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Header file implementing LSD radix sort
+ */
+
+#ifndef LSDRADIXSORT_H
+#define LSDRADIXSORT_H
+
+#include <algorithm> // For std::copy
+#include <climits>   // For CHAR_BIT
+#include <cstddef>   // For size_t
+#include <iterator>
+#include <vector>
+#include "binaryquicksort.h"
+
+/**
+ * Function: LsdRadixSort(RandomIterator begin, RandomIterator end,
+ *                        ScratchIterator scratch);
+ * Usage: LsdRadixSort(v.begin(), v.end(), buffer.begin());
+ * ------------------------------------------------------------------------
+ * Sorts the specified list of numbers using a least-significant-digit
+ * radix sort, one byte at a time.  As with BinaryQuicksort, the numbers may
+ * be of any integral type or IEEE-754 floats or doubles.  The scratch
+ * iterator must point to room for at least end - begin values; it is used
+ * as the other half of a ping-pong buffer, so no memory is allocated.  Its
+ * contents on return are unspecified.
+ */
+template <typename RandomIterator, typename ScratchIterator>
+void LsdRadixSort(RandomIterator begin, RandomIterator end,
+                  ScratchIterator scratch);
+
+/**
+ * Function: LsdRadixSort(RandomIterator begin, RandomIterator end);
+ * Usage: LsdRadixSort(v.begin(), v.end());
+ * ------------------------------------------------------------------------
+ * Sorts the specified list of integers using a least-significant-digit
+ * radix sort, allocating a scratch buffer as large as the input.
+ */
+template <typename RandomIterator>
+void LsdRadixSort(RandomIterator begin, RandomIterator end);
+
+/* * * * * Implementation Below This Point * * * * */
+namespace lsdradixsort_detail {
+  /* Utility function that stably distributes the elements of [begin, end)
+   * into out according to the digit whose lowest bit is lowBit.  The
+   * histogram of that digit has already been computed.
+   */
+  template <typename InIterator, typename OutIterator>
+  void ScatterByDigit(InIterator begin, InIterator end, OutIterator out,
+                      const size_t* counts, signed int lowBit) {
+    using binaryquicksort_detail::DigitAt;
+    using binaryquicksort_detail::kNumByteBuckets;
+
+    /* Turn the counts into the position of the next slot in each bucket. */
+    size_t nextSlot[kNumByteBuckets];
+    size_t total = 0;
+    for (size_t i = 0; i < kNumByteBuckets; ++i) {
+      nextSlot[i] = total;
+      total += counts[i];
+    }
+
+    /* Drop each element into the next free slot of its bucket. */
+    for (; begin != end; ++begin)
+      *(out + nextSlot[DigitAt(*begin, lowBit)]++) = *begin;
+  }
+}
+
+/* Actual implementation of LSD radix sort. */
+template <typename RandomIterator, typename ScratchIterator>
+void LsdRadixSort(RandomIterator begin, RandomIterator end,
+                  ScratchIterator scratch) {
+    /* Grant access to our helper functions. */
+    using namespace lsdradixsort_detail;
+    using binaryquicksort_detail::DigitAt;
+    using binaryquicksort_detail::kNumByteBuckets;
+
+    /* Typedef defining the type of the elements being traversed. */
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Find out how many digits we need to process. */
+    const size_t kNumDigits = sizeof(T);
+
+    const size_t numElems = size_t(end - begin);
+    if (numElems < 2) return;
+
+    /* Build the histogram of every digit at once, in a single read over the
+     * input.
+     */
+    size_t counts[kNumDigits][kNumByteBuckets] = {};
+    for (RandomIterator itr = begin; itr != end; ++itr)
+      for (size_t digit = 0; digit < kNumDigits; ++digit)
+        ++counts[digit][DigitAt(*itr, signed(digit * CHAR_BIT))];
+
+    /* Sort by each digit in turn, bouncing between the input and the scratch
+     * buffer.  If every element has the same value for some digit, then the
+     * pass would just copy the data, so we skip it.  Both buffers always
+     * hold the same values, so we can probe the digit through begin no matter
+     * which buffer is current.
+     */
+    bool inScratch = false;
+    for (size_t digit = 0; digit < kNumDigits; ++digit) {
+      const signed int lowBit = signed(digit * CHAR_BIT);
+      if (counts[digit][DigitAt(*begin, lowBit)] == numElems)
+        continue;
+
+      if (inScratch)
+        ScatterByDigit(scratch, scratch + numElems, begin, counts[digit], lowBit);
+      else
+        ScatterByDigit(begin, end, scratch, counts[digit], lowBit);
+      inScratch = !inScratch;
+    }
+
+    /* If the sorted data ended up in the scratch buffer, copy it home. */
+    if (inScratch)
+      std::copy(scratch, scratch + numElems, begin);
+}
+
+/* Convenience version that allocates its own scratch buffer. */
+template <typename RandomIterator>
+void LsdRadixSort(RandomIterator begin, RandomIterator end) {
+    /* Typedef defining the type of the elements being traversed. */
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    std::vector<T> scratch(size_t(end - begin));
+    LsdRadixSort(begin, end, scratch.begin());
+}
+
+#endif // LSDRADIXSORT_H
@@ -0,0 +1,367 @@
+/**
+ * @headerfile simdpartition.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Header file implementing a vectorized quicksort partition
+ */
+
+#ifndef SIMDPARTITION_H
+#define SIMDPARTITION_H
+
+#include <cstddef>     // For size_t
+#include <type_traits>
+
+/**
+ * Function: SimdPartition(T* begin, T* end, T pivot);
+ * Usage: int* split = SimdPartition(v.data(), v.data() + v.size(), 137);
+ * ------------------------------------------------------------------------
+ * Rearranges the array [begin, end) so that the values less than pivot
+ * come before the rest, and returns a pointer to the first value that
+ * isn't less than pivot.  T must be a 32- or 64-bit integer, a float, or a
+ * double.  On x86 processors with AVX2, the values are compared eight or
+ * four at a time, and each block is split with a single shuffle; otherwise,
+ * ordinary scalar code is used.
+ */
+template <typename T>
+T* SimdPartition(T* begin, T* end, T pivot);
+
+/**
+ * Function: SimdPartitionSupported();
+ * Usage: if (SimdPartitionSupported()) { ... }
+ * ------------------------------------------------------------------------
+ * Returns whether SimdPartition will use vector instructions on this
+ * processor.  The answer is computed once and cached.
+ */
+inline bool SimdPartitionSupported();
+
+/* * * * * Implementation Below This Point * * * * */
+#include <cstdint>     // For uint32_t
+#include <cstring>     // For memcpy
+#include <iterator>    // For iterator_traits
+#include <vector>
+
+/* The vector kernels use GCC and Clang's per-function target attribute, so
+ * that they can be compiled into any program and only run on processors
+ * that support them.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define SIMDPARTITION_HAS_AVX2 1
+#define SIMDPARTITION_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#include <immintrin.h>
+#else
+#define SIMDPARTITION_HAS_AVX2 0
+#endif
+
+namespace simdpartition_detail {
+  /* The kinds of keys that the vector kernels know how to compare. */
+  enum KeyKind {
+    kUnsupportedKey, kSigned32, kUnsigned32, kFloat32,
+    kSigned64, kUnsigned64, kFloat64
+  };
+
+  /* A type trait mapping a key type to its KeyKind. */
+  template <typename T>
+  struct KeyKindOf : std::integral_constant<int,
+    std::is_same<T, float>::value?  int(kFloat32) :
+    std::is_same<T, double>::value? int(kFloat64) :
+    (!std::is_integral<T>::value || std::is_same<T, bool>::value)?
+      int(kUnsupportedKey) :
+    sizeof(T) == 4? (std::is_signed<T>::value? int(kSigned32) : int(kUnsigned32)) :
+    sizeof(T) == 8? (std::is_signed<T>::value? int(kSigned64) : int(kUnsigned64)) :
+    int(kUnsupportedKey)> {};
+
+  /* A type trait that determines whether an iterator walks a contiguous
+   * array, so that the elements it covers can be handed to the kernels
+   * here as raw pointers.  Raw pointers and vector iterators are recognized.
+   */
+  template <typename RandomIterator>
+  struct IsContiguousIterator
+    : std::integral_constant<bool,
+        std::is_pointer<RandomIterator>::value ||
+        std::is_same<RandomIterator,
+                     typename std::vector<typename std::iterator_traits<RandomIterator>::value_type>::iterator>::value> {};
+
+  /**
+   * Function: ScalarPartitionBy(T* begin, T* end, Predicate pred);
+   * ----------------------------------------------------------------------
+   * The fallback for the vector kernels, using the usual pair of scans to
+   * move the values satisfying pred to the front.
+   */
+  template <typename T, typename Predicate>
+  T* ScalarPartitionBy(T* begin, T* end, Predicate pred) {
+    while (true) {
+      while (begin < end && pred(*begin))
+        ++begin;
+      while (begin < end && !pred(*(end - 1)))
+        --end;
+      if (begin == end) return begin;
+
+      --end;
+      const T temp = *begin;
+      *begin = *end;
+      *end = temp;
+      ++begin;
+    }
+  }
+
+#if SIMDPARTITION_HAS_AVX2
+  /* Tables of lane permutations, indexed by a bitmask of the lanes holding
+   * values less than the pivot.  Each permutation moves those lanes to the
+   * front, in order, and the others to the back.  The entries are 32-bit
+   * lane indices, as _mm256_permutevar8x32_epi32 expects; for 64-bit keys,
+   * each key occupies two adjacent 32-bit lanes.
+   */
+  struct CompressTable {
+    uint32_t lanes32[256][8];
+    uint32_t lanes64[16][8];
+
+    CompressTable() {
+      for (uint32_t mask = 0; mask < 256; ++mask) {
+        size_t next = 0;
+        for (uint32_t lane = 0; lane < 8; ++lane)
+          if (mask & (1u << lane)) lanes32[mask][next++] = lane;
+        for (uint32_t lane = 0; lane < 8; ++lane)
+          if (!(mask & (1u << lane))) lanes32[mask][next++] = lane;
+      }
+      for (uint32_t mask = 0; mask < 16; ++mask) {
+        size_t next = 0;
+        for (uint32_t key = 0; key < 4; ++key) {
+          if (mask & (1u << key)) {
+            lanes64[mask][next++] = 2 * key;
+            lanes64[mask][next++] = 2 * key + 1;
+          }
+        }
+        for (uint32_t key = 0; key < 4; ++key) {
+          if (!(mask & (1u << key))) {
+            lanes64[mask][next++] = 2 * key;
+            lanes64[mask][next++] = 2 * key + 1;
+          }
+        }
+      }
+    }
+  };
+
+  /* Returns the permutation tables, building them on first use. */
+  inline const CompressTable& GetCompressTable() {
+    static const CompressTable table;
+    return table;
+  }
+
+  /* Per-kind vector operations.  Broadcast fills a vector with the pivot,
+   * and LessMask returns a bitmask of the lanes of a vector that are less
+   * than it.  AVX2 only compares signed integers, so unsigned keys (and
+   * their pivot) have their sign bits flipped first, which preserves their
+   * order.  Floating-point comparisons are ordered, so NaN is never less
+   * than anything, just as with operator<.
+   */
+  template <int Kind> struct Avx2Keys;
+
+  template <> struct Avx2Keys<kSigned32> {
+    template <typename T>
+    SIMDPARTITION_TARGET_AVX2 static __m256i Broadcast(T pivot) {
+      return _mm256_set1_epi32(int32_t(pivot));
+    }
+    SIMDPARTITION_TARGET_AVX2 static unsigned LessMask(__m256i v, __m256i pivot) {
+      return unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(pivot, v))));
+    }
+  };
+
+  template <> struct Avx2Keys<kUnsigned32> {
+    template <typename T>
+    SIMDPARTITION_TARGET_AVX2 static __m256i Broadcast(T pivot) {
+      return _mm256_set1_epi32(int32_t(uint32_t(pivot) ^ 0x80000000u));
+    }
+    SIMDPARTITION_TARGET_AVX2 static unsigned LessMask(__m256i v, __m256i pivot) {
+      const __m256i flipped = _mm256_xor_si256(v, _mm256_set1_epi32(int32_t(0x80000000u)));
+      return unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(pivot, flipped))));
+    }
+  };
+
+  template <> struct Avx2Keys<kFloat32> {
+    template <typename T>
+    SIMDPARTITION_TARGET_AVX2 static __m256i Broadcast(T pivot) {
+      return _mm256_castps_si256(_mm256_set1_ps(float(pivot)));
+    }
+    SIMDPARTITION_TARGET_AVX2 static unsigned LessMask(__m256i v, __m256i pivot) {
+      return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_castsi256_ps(v),
+                                                       _mm256_castsi256_ps(pivot),
+                                                       _CMP_LT_OQ)));
+    }
+  };
+
+  template <> struct Avx2Keys<kSigned64> {
+    template <typename T>
+    SIMDPARTITION_TARGET_AVX2 static __m256i Broadcast(T pivot) {
+      return _mm256_set1_epi64x((long long)(pivot));
+    }
+    SIMDPARTITION_TARGET_AVX2 static unsigned LessMask(__m256i v, __m256i pivot) {
+      return unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, v))));
+    }
+  };
+
+  template <> struct Avx2Keys<kUnsigned64> {
+    template <typename T>
+    SIMDPARTITION_TARGET_AVX2 static __m256i Broadcast(T pivot) {
+      return _mm256_set1_epi64x((long long)(uint64_t(pivot) ^ (uint64_t(1) << 63)));
+    }
+    SIMDPARTITION_TARGET_AVX2 static unsigned LessMask(__m256i v, __m256i pivot) {
+      const __m256i flipped =
+        _mm256_xor_si256(v, _mm256_set1_epi64x((long long)(uint64_t(1) << 63)));
+      return unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, flipped))));
+    }
+  };
+
+  template <> struct Avx2Keys<kFloat64> {
+    template <typename T>
+    SIMDPARTITION_TARGET_AVX2 static __m256i Broadcast(T pivot) {
+      return _mm256_castpd_si256(_mm256_set1_pd(double(pivot)));
+    }
+    SIMDPARTITION_TARGET_AVX2 static unsigned LessMask(__m256i v, __m256i pivot) {
+      return unsigned(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_castsi256_pd(v),
+                                                       _mm256_castsi256_pd(pivot),
+                                                       _CMP_LT_OQ)));
+    }
+  };
+
+  /**
+   * Function: Avx2PartitionBy(T* begin, T* end, Predicate pred);
+   * ----------------------------------------------------------------------
+   * The AVX2 kernel behind SimdPartition, which moves the values satisfying
+   * pred to the front of the array and returns the end of them.  It loads
+   * one vector at a time, tests every lane at once, and shuffles the lanes
+   * that pass to the front of the vector and the rest to the back.  The
+   * whole vector is then stored at both the left and the right write
+   * positions, and each position advances past just the lanes that belong
+   * there.
+   *
+   * Writing a full vector needs a vector's worth of free space on each side,
+   * so the first and last vectors are set aside at the start.  Each step
+   * then reads from whichever side has less free space, which keeps at
+   * least one vector's worth free on both sides.  When less than a vector
+   * remains unread, the leftovers and the two set-aside vectors are placed
+   * one at a time into the gap that remains, which is exactly big enough.
+   *
+   * Besides testing a single value, pred must provide Setup, which returns
+   * a vector of whatever constants the test needs, and Mask, which takes a
+   * vector of values and the result of Setup and returns a bitmask of the
+   * lanes that pass.
+   */
+  template <typename T, typename Predicate>
+  SIMDPARTITION_TARGET_AVX2
+  T* Avx2PartitionBy(T* begin, T* end, Predicate pred) {
+    const size_t kLanes = sizeof(__m256i) / sizeof(T);
+
+    /* Small arrays aren't worth setting up for. */
+    if (size_t(end - begin) < 4 * kLanes)
+      return ScalarPartitionBy(begin, end, pred);
+
+    const CompressTable& table = GetCompressTable();
+    const uint32_t (*permutations)[8] = (kLanes == 8)? table.lanes32 : table.lanes64;
+    const __m256i constants = pred.Setup();
+
+    /* Set aside the first and last vectors.  The rest of this buffer will
+     * hold the leftovers at the end.
+     */
+    T setAside[3 * kLanes];
+    std::memcpy(setAside, begin, kLanes * sizeof(T));
+    std::memcpy(setAside + kLanes, end - kLanes, kLanes * sizeof(T));
+
+    /* Values in [readLeft, readRight) haven't been looked at yet.  Values
+     * in [begin, writeLeft) satisfy pred, and values in [writeRight, end)
+     * don't.
+     */
+    T* readLeft   = begin + kLanes;
+    T* readRight  = end - kLanes;
+    T* writeLeft  = begin;
+    T* writeRight = end;
+
+    while (size_t(readRight - readLeft) >= kLanes) {
+      __m256i values;
+      if (readLeft - writeLeft <= writeRight - readRight) {
+        values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(readLeft));
+        readLeft += kLanes;
+      } else {
+        readRight -= kLanes;
+        values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(readRight));
+      }
+
+      const unsigned mask = pred.Mask(values, constants);
+      const size_t numLess = size_t(__builtin_popcount(mask));
+      const __m256i permutation =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(permutations[mask]));
+      const __m256i packed = _mm256_permutevar8x32_epi32(values, permutation);
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(writeLeft), packed);
+      writeLeft += numLess;
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(writeRight - kLanes), packed);
+      writeRight -= kLanes - numLess;
+    }
+
+    /* Place the leftovers and the set-aside vectors one at a time. */
+    const size_t numLeft = size_t(readRight - readLeft);
+    std::memcpy(setAside + 2 * kLanes, readLeft, numLeft * sizeof(T));
+    for (size_t i = 0; i < 2 * kLanes + numLeft; ++i) {
+      if (pred(setAside[i])) *writeLeft++ = setAside[i];
+      else *--writeRight = setAside[i];
+    }
+    return writeLeft;
+  }
+
+  /* Asks the processor whether it supports AVX2. */
+  inline bool DetectAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  }
+#endif
+
+  /* The predicate used by SimdPartition, which tests whether values are
+   * less than the pivot.
+   */
+  template <int Kind, typename T>
+  struct LessThanPivot {
+    T pivot;
+
+    bool operator()(const T& value) const {
+      return value < pivot;
+    }
+
+#if SIMDPARTITION_HAS_AVX2
+    SIMDPARTITION_TARGET_AVX2 __m256i Setup() const {
+      return Avx2Keys<Kind>::Broadcast(pivot);
+    }
+    SIMDPARTITION_TARGET_AVX2 unsigned Mask(__m256i values, __m256i pivots) const {
+      return Avx2Keys<Kind>::LessMask(values, pivots);
+    }
+#endif
+  };
+}
+
+/* Implementation of the vectorized partition. */
+template <typename T>
+T* SimdPartition(T* begin, T* end, T pivot) {
+  static_assert(simdpartition_detail::KeyKindOf<T>::value !=
+                simdpartition_detail::kUnsupportedKey,
+                "SimdPartition needs 32- or 64-bit integers, floats, or doubles.");
+
+  const simdpartition_detail::LessThanPivot<simdpartition_detail::KeyKindOf<T>::value, T>
+    pred = { pivot };
+
+#if SIMDPARTITION_HAS_AVX2
+  if (SimdPartitionSupported())
+    return simdpartition_detail::Avx2PartitionBy(begin, end, pred);
+#endif
+  return simdpartition_detail::ScalarPartitionBy(begin, end, pred);
+}
+
+/* Implementation of the processor check. */
+inline bool SimdPartitionSupported() {
+#if SIMDPARTITION_HAS_AVX2
+  static const bool supported = simdpartition_detail::DetectAvx2();
+  return supported;
+#else
+  return false;
+#endif
+}
+
+#endif // SIMDPARTITION_H
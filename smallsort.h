@@ -0,0 +1,335 @@
+/**
+ * @headerfile smallsort.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Header file implementing sorting networks for small ranges
+ */
+
+#ifndef SMALLSORT_H
+#define SMALLSORT_H
+
+#include <cstddef>    // For size_t
+#include <functional> // For less
+#include <iterator>   // For iterator_traits
+
+/**
+ * Function: SmallSort<N>(RandomIterator begin);
+ * Function: SmallSort<N>(RandomIterator begin, Comparator comp);
+ * Usage: SmallSort<8>(v.begin());
+ * ------------------------------------------------------------------------
+ * Sorts the N elements starting at begin into ascending order (according
+ * to comp, or the default ordering) using a sorting network.  A sorting
+ * network is a fixed sequence of compare-exchange steps that sorts any
+ * input of its size, so the code does the same thing no matter what the
+ * data look like.  For arithmetic types under std::less or std::greater,
+ * each compare-exchange is done without branches.  N may be at most
+ * kMaxSmallSortSize.
+ */
+template <size_t N, typename RandomIterator>
+void SmallSort(RandomIterator begin);
+template <size_t N, typename RandomIterator, typename Comparator>
+void SmallSort(RandomIterator begin, Comparator comp);
+
+/**
+ * Function: SmallSort(RandomIterator begin, RandomIterator end);
+ * Function: SmallSort(RandomIterator begin, RandomIterator end,
+ *                     Comparator comp);
+ * Usage: SmallSort(v.begin(), v.end());
+ * ------------------------------------------------------------------------
+ * Sorts the range [begin, end) using the sorting network for its size.
+ * Ranges longer than kMaxSmallSortSize have no network and are sorted with
+ * insertion sort instead, which is correct but quadratic, so callers
+ * should keep their ranges small.
+ */
+template <typename RandomIterator>
+void SmallSort(RandomIterator begin, RandomIterator end);
+template <typename RandomIterator, typename Comparator>
+void SmallSort(RandomIterator begin, RandomIterator end, Comparator comp);
+
+/* The largest range that SmallSort has a sorting network for. */
+const size_t kMaxSmallSortSize = 32;
+
+/* * * * * Implementation Below This Point * * * * */
+#include <algorithm>   // For iter_swap
+#include <type_traits>
+#include <utility>     // For move
+
+namespace smallsort_detail {
+  /* A type trait that determines whether compare-exchanges on the given
+   * element type and comparator can be done without branching.  This is the
+   * case for arithmetic types under the standard comparators, where the
+   * compiler can turn the selects below into conditional moves or min/max
+   * instructions.  Introsort uses the same test to choose its branch-free
+   * block partition.
+   */
+  template <typename T, typename Comparator>
+  struct HasBranchlessCompare : std::false_type {};
+
+  template <typename T>
+  struct HasBranchlessCompare<T, std::less<T> >
+    : std::integral_constant<bool, std::is_arithmetic<T>::value> {};
+
+  template <typename T>
+  struct HasBranchlessCompare<T, std::greater<T> >
+    : std::integral_constant<bool, std::is_arithmetic<T>::value> {};
+
+  /**
+   * Function: CompareExchange(RandomIterator one, RandomIterator two,
+   *                           Comparator comp, std::false_type);
+   * ----------------------------------------------------------------------
+   * Swaps *one and *two if they're out of order.  This version works for
+   * any type, and branches on the comparison.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void CompareExchange(RandomIterator one, RandomIterator two,
+                       Comparator comp, std::false_type) {
+    if (comp(*two, *one))
+      std::iter_swap(one, two);
+  }
+
+  /**
+   * Function: CompareExchange(RandomIterator one, RandomIterator two,
+   *                           Comparator comp, std::true_type);
+   * ----------------------------------------------------------------------
+   * Swaps *one and *two if they're out of order, for cheap arithmetic
+   * types.  Both values are always written back, selected by the result of
+   * the comparison, so there is no branch to mispredict.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void CompareExchange(RandomIterator one, RandomIterator two,
+                       Comparator comp, std::true_type) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    const T first = *one;
+    const T second = *two;
+    const bool outOfOrder = comp(second, first);
+    *one = outOfOrder? second : first;
+    *two = outOfOrder? first : second;
+  }
+
+  /* The networks below are Bose and Nelson's, generated at compile time by
+   * template recursion rather than listed by hand.  To sort M elements
+   * starting at index I, BoseNelsonSort sorts the first half and the second
+   * half and then merges them with BoseNelsonMerge.  To merge the X sorted
+   * elements at index I with the Y sorted elements at index J,
+   * BoseNelsonMerge handles the smallest cases directly and otherwise
+   * splits both runs, merges the matching pieces, and then merges the two
+   * pieces in the middle.  Each struct's Run function performs the
+   * compare-exchanges at fixed offsets from begin, so after inlining, a
+   * call to SmallSort<N> is a straight-line sequence of them.
+   */
+  template <size_t I, size_t X, size_t J, size_t Y>
+  struct BoseNelsonMerge {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator begin, Comparator comp, Branchless tag) {
+      const size_t A = X / 2;
+      const size_t B = (X % 2 == 1)? Y / 2 : (Y + 1) / 2;
+      BoseNelsonMerge<I, A, J, B>::Run(begin, comp, tag);
+      BoseNelsonMerge<I + A, X - A, J + B, Y - B>::Run(begin, comp, tag);
+      BoseNelsonMerge<I + A, X - A, J, B>::Run(begin, comp, tag);
+    }
+  };
+
+  /* Merging with an empty run does nothing. */
+  template <size_t I, size_t J, size_t Y>
+  struct BoseNelsonMerge<I, 0, J, Y> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator, Comparator, Branchless) {
+      // Nothing to do
+    }
+  };
+
+  template <size_t I, size_t X, size_t J>
+  struct BoseNelsonMerge<I, X, J, 0> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator, Comparator, Branchless) {
+      // Nothing to do
+    }
+  };
+
+  template <size_t I, size_t J>
+  struct BoseNelsonMerge<I, 0, J, 0> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator, Comparator, Branchless) {
+      // Nothing to do
+    }
+  };
+
+  /* Merging two single elements is one compare-exchange. */
+  template <size_t I, size_t J>
+  struct BoseNelsonMerge<I, 1, J, 1> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator begin, Comparator comp, Branchless tag) {
+      CompareExchange(begin + I, begin + J, comp, tag);
+    }
+  };
+
+  /* Merging a single element with a pair takes two. */
+  template <size_t I, size_t J>
+  struct BoseNelsonMerge<I, 1, J, 2> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator begin, Comparator comp, Branchless tag) {
+      CompareExchange(begin + I, begin + (J + 1), comp, tag);
+      CompareExchange(begin + I, begin + J, comp, tag);
+    }
+  };
+
+  template <size_t I, size_t J>
+  struct BoseNelsonMerge<I, 2, J, 1> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator begin, Comparator comp, Branchless tag) {
+      CompareExchange(begin + I, begin + J, comp, tag);
+      CompareExchange(begin + (I + 1), begin + J, comp, tag);
+    }
+  };
+
+  template <size_t I, size_t M>
+  struct BoseNelsonSort {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator begin, Comparator comp, Branchless tag) {
+      const size_t A = M / 2;
+      BoseNelsonSort<I, A>::Run(begin, comp, tag);
+      BoseNelsonSort<I + A, M - A>::Run(begin, comp, tag);
+      BoseNelsonMerge<I, A, I + A, M - A>::Run(begin, comp, tag);
+    }
+  };
+
+  /* Zero or one elements are already sorted. */
+  template <size_t I>
+  struct BoseNelsonSort<I, 0> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator, Comparator, Branchless) {
+      // Nothing to do
+    }
+  };
+
+  template <size_t I>
+  struct BoseNelsonSort<I, 1> {
+    template <typename RandomIterator, typename Comparator, typename Branchless>
+    static void Run(RandomIterator, Comparator, Branchless) {
+      // Nothing to do
+    }
+  };
+
+  /**
+   * Function: InsertionSort(RandomIterator begin, RandomIterator end,
+   *                         Comparator comp);
+   * ----------------------------------------------------------------------
+   * Sorts the range [begin, end) into ascending order (according to comp)
+   * using insertion sort.  SmallSort uses this for ranges too long for any
+   * of the networks, and introsort uses it for leaves without a branch-free
+   * network.
+   */
+  template <typename RandomIterator, typename Comparator>
+  void InsertionSort(RandomIterator begin, RandomIterator end,
+                     Comparator comp) {
+    /* Edge case check - if there are no elements or exactly one element,
+     * we're done.
+     */
+    if (begin == end || begin + 1 == end) return;
+
+    /* Typedef defining the type of the elements being sorted. */
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Starting at the second element and continuing rightward, put each
+     * element in its proper position.
+     */
+    for (RandomIterator itr = begin + 1; itr != end; ++itr) {
+      /* If the element is already in place, leave it alone. */
+      if (!comp(*itr, *(itr - 1))) continue;
+
+      /* Otherwise, take it out, leaving a hole, and shift the larger
+       * elements before it up one step until we hit the beginning or are in
+       * the correct position.  Each step costs one move, rather than the
+       * three that swapping the element down would take.
+       */
+      T value(std::move(*itr));
+      RandomIterator hole = itr;
+      do {
+        *hole = std::move(*(hole - 1));
+        --hole;
+      } while (hole != begin && comp(value, *(hole - 1)));
+      *hole = std::move(value);
+    }
+  }
+
+  /**
+   * Function: RunNetwork<N>(RandomIterator begin, Comparator comp);
+   * ----------------------------------------------------------------------
+   * Runs the sorting network for N elements on the range starting at
+   * begin, choosing the kind of compare-exchange from the types involved.
+   */
+  template <size_t N, typename RandomIterator, typename Comparator>
+  void RunNetwork(RandomIterator begin, Comparator comp) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+    BoseNelsonSort<0, N>::Run(begin, comp, HasBranchlessCompare<T, Comparator>());
+  }
+}
+
+/* Implementation of the fixed-size sort. */
+template <size_t N, typename RandomIterator, typename Comparator>
+void SmallSort(RandomIterator begin, Comparator comp) {
+  static_assert(N <= kMaxSmallSortSize, "SmallSort only handles small ranges.");
+  smallsort_detail::RunNetwork<N>(begin, comp);
+}
+
+/* Implementation of the variable-size sort.  Each case is a different
+ * network, and the switch turns into a jump table.  Ranges too long for a
+ * network fall back on insertion sort.
+ */
+template <typename RandomIterator, typename Comparator>
+void SmallSort(RandomIterator begin, RandomIterator end, Comparator comp) {
+  using smallsort_detail::RunNetwork;
+
+  switch (end - begin) {
+  case 2:  RunNetwork<2>(begin, comp);  break;
+  case 3:  RunNetwork<3>(begin, comp);  break;
+  case 4:  RunNetwork<4>(begin, comp);  break;
+  case 5:  RunNetwork<5>(begin, comp);  break;
+  case 6:  RunNetwork<6>(begin, comp);  break;
+  case 7:  RunNetwork<7>(begin, comp);  break;
+  case 8:  RunNetwork<8>(begin, comp);  break;
+  case 9:  RunNetwork<9>(begin, comp);  break;
+  case 10: RunNetwork<10>(begin, comp); break;
+  case 11: RunNetwork<11>(begin, comp); break;
+  case 12: RunNetwork<12>(begin, comp); break;
+  case 13: RunNetwork<13>(begin, comp); break;
+  case 14: RunNetwork<14>(begin, comp); break;
+  case 15: RunNetwork<15>(begin, comp); break;
+  case 16: RunNetwork<16>(begin, comp); break;
+  case 17: RunNetwork<17>(begin, comp); break;
+  case 18: RunNetwork<18>(begin, comp); break;
+  case 19: RunNetwork<19>(begin, comp); break;
+  case 20: RunNetwork<20>(begin, comp); break;
+  case 21: RunNetwork<21>(begin, comp); break;
+  case 22: RunNetwork<22>(begin, comp); break;
+  case 23: RunNetwork<23>(begin, comp); break;
+  case 24: RunNetwork<24>(begin, comp); break;
+  case 25: RunNetwork<25>(begin, comp); break;
+  case 26: RunNetwork<26>(begin, comp); break;
+  case 27: RunNetwork<27>(begin, comp); break;
+  case 28: RunNetwork<28>(begin, comp); break;
+  case 29: RunNetwork<29>(begin, comp); break;
+  case 30: RunNetwork<30>(begin, comp); break;
+  case 31: RunNetwork<31>(begin, comp); break;
+  case 32: RunNetwork<32>(begin, comp); break;
+  case 0:
+  case 1:  break; // Zero or one elements are already sorted.
+  default: smallsort_detail::InsertionSort(begin, end, comp); break;
+  }
+}
+
+/* Non-comparator versions use the default comparator. */
+template <size_t N, typename RandomIterator>
+void SmallSort(RandomIterator begin) {
+  SmallSort<N>(begin,
+               std::less<typename std::iterator_traits<RandomIterator>::value_type>());
+}
+
+template <typename RandomIterator>
+void SmallSort(RandomIterator begin, RandomIterator end) {
+  SmallSort(begin, end,
+            std::less<typename std::iterator_traits<RandomIterator>::value_type>());
+}
+
+#endif // SMALLSORT_H
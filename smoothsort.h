@@ -10,7 +10,11 @@
 
 #include <iterator>
 #include <algorithm>
-#include <bitset>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
 
 /**
  * Function: Smoothsort(RandomIterator begin, RandomIterator end);
@@ -33,37 +37,124 @@ void Smoothsort(RandomIterator begin, RandomIterator end, Comparator comp);
 
 /* * * * * Implementation Below This Point * * * * */
 namespace smoothsort_detail {
-  /* A constant containing the number of Leonardo numbers that can fit into
-   * 32 bits.  For a 64-bit machine, you'll need to update this value and the
-   * list below.
+  /* The Leonardo numbers are defined by L(0) = L(1) = 1 and
+   * L(k + 2) = L(k + 1) + L(k) + 1.  Rather than listing them by hand, we
+   * generate a table at compile time of every one that fits in a size_t,
+   * which is 92 of them on a 64-bit machine and 46 on a 32-bit one.
+   *
+   * C++11 constexpr functions may only consist of a single return statement,
+   * so these are all written recursively.  The recursion carries the last
+   * two Leonardo numbers along so that it takes linear rather than
+   * exponential time.
    */
-  const size_t kNumLeonardoNumbers = 46;
 
-  /* A list of all the Leonardo numbers below 2^32, precomputed for
+  /* Returns L(k), given that a = L(i) and b = L(i + 1) for the i that is k
+   * steps before the one wanted.
+   */
+  constexpr size_t LeonardoNumber(size_t k, size_t a = 1, size_t b = 1) {
+    return k == 0? a : LeonardoNumber(k - 1, b, a + b + 1);
+  }
+
+  /* Returns the number of Leonardo numbers that fit in a size_t, given that
+   * a and b are the last two of the count found so far.
+   */
+  constexpr size_t CountLeonardoNumbers(size_t a = 1, size_t b = 1,
+                                        size_t count = 2) {
+    return b > std::numeric_limits<size_t>::max() - a - 1?
+           count : CountLeonardoNumbers(b, a + b + 1, count + 1);
+  }
+
+  /* A constant containing the number of Leonardo numbers that fit into a
+   * size_t.
+   */
+  const size_t kNumLeonardoNumbers = CountLeonardoNumbers();
+
+  /* A compile-time list of the integers 0, 1, ..., N - 1, used to expand
+   * LeonardoNumber over every index of the table.
+   */
+  template <size_t... Indices> struct IndexList {};
+
+  template <size_t N, size_t... Indices>
+  struct MakeIndexList : MakeIndexList<N - 1, N - 1, Indices...> {};
+
+  template <size_t... Indices>
+  struct MakeIndexList<0, Indices...> {
+    typedef IndexList<Indices...> type;
+  };
+
+  /* A struct holding the table of Leonardo numbers with the given indices. */
+  template <typename Indices> struct LeonardoTable;
+
+  template <size_t... Indices>
+  struct LeonardoTable< IndexList<Indices...> > {
+    static const size_t kValues[sizeof...(Indices)];
+  };
+
+  template <size_t... Indices>
+  const size_t LeonardoTable< IndexList<Indices...> >::kValues[sizeof...(Indices)] = {
+    LeonardoNumber(Indices)...
+  };
+
+  /* A list of all the Leonardo numbers that fit in a size_t, precomputed for
    * efficiency.
    * Source: http://oeis.org/classic/b001595.txt
    */
-  const size_t kLeonardoNumbers[kNumLeonardoNumbers] = {
-    1u, 1u, 3u, 5u, 9u, 15u, 25u, 41u, 67u, 109u, 177u, 287u, 465u, 753u,
-    1219u, 1973u, 3193u, 5167u, 8361u, 13529u, 21891u, 35421u, 57313u, 92735u,
-    150049u, 242785u, 392835u, 635621u, 1028457u, 1664079u, 2692537u,
-    4356617u, 7049155u, 11405773u, 18454929u, 29860703u, 48315633u, 78176337u,
-    126491971u, 204668309u, 331160281u, 535828591u, 866988873u, 1402817465u,
-    2269806339u, 3672623805u
-  };
+  const size_t* const kLeonardoNumbers =
+    LeonardoTable< MakeIndexList<kNumLeonardoNumbers>::type >::kValues;
 
   /* A structure containing a bitvector encoding of the trees in a Leonardo
    * heap.  The representation is as a bitvector shifted down so that its
    * first digit is a one, along with the amount that it was shifted.
+   *
+   * The bitvector is a single 64-bit word, so every update to the shape is a
+   * shift or a mask.  Bit i stands for a tree of order smallestTreeSize + i,
+   * and the largest tree always has order at most lg_phi(n), so the bits
+   * never run out unless a tree of order 64 is needed.  The smallest such
+   * heap has L(64), or about 3.4 * 10^13, elements, which is far larger than
+   * anything that fits in memory.
    */
   struct HeapShape {
-    /* A bitvector capable of holding all the Leonardo numbers. */
-    std::bitset<kNumLeonardoNumbers> trees;
+    /* A bitvector holding one bit per possible tree order. */
+    uint64_t trees;
 
     /* The shift amount, which is also the size of the smallest tree. */
     size_t smallestTreeSize;
   };
 
+  /**
+   * Function: size_t CountTrailingZeros(uint64_t bits);
+   * ---------------------------------------------------------------------
+   * Returns the number of zero bits below the lowest set bit of bits,
+   * which must be nonzero.  This compiles to a single instruction on
+   * compilers that provide the intrinsic.
+   */
+  inline size_t CountTrailingZeros(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return size_t(__builtin_ctzll((unsigned long long)bits));
+#else
+    size_t count = 0;
+    for (; (bits & 1) == 0; bits >>= 1)
+      ++count;
+    return count;
+#endif
+  }
+
+  /**
+   * Function: SkipToNextTree(HeapShape& shape);
+   * ---------------------------------------------------------------------
+   * Drops the smallest tree from the shape, shifting the bitvector down to
+   * the next tree if there is one.
+   */
+  inline void SkipToNextTree(HeapShape& shape) {
+    shape.trees >>= 1;
+    ++shape.smallestTreeSize;
+    if (shape.trees != 0) {
+      const size_t gap = CountTrailingZeros(shape.trees);
+      shape.trees >>= gap;
+      shape.smallestTreeSize += gap;
+    }
+  }
+
   /**
    * Function: RandomIterator SecondChild(RandomIterator root)
    * ---------------------------------------------------------------------
@@ -94,20 +185,64 @@ namespace smoothsort_detail {
 
   /**
    * Function: RandomIterator LargerChild(RandomIterator root, size_t size,
-   *                                      Comparator comp);
+   *                                      Comparator comp, size_t& childSize);
    * --------------------------------------------------------------------
    * Given an iterator to the root of a max-heap Leonardo tree, returns
-   * an iterator to its larger child.  It's assumed that the heap is
-   * well-formatted and that the heap has order > 1.
+   * an iterator to its larger child and stores the order of that child's
+   * tree in childSize.  It's assumed that the heap is well-formatted and
+   * that the heap has order > 1.
    */
   template <typename RandomIterator, typename Comparator>
-  RandomIterator LargerChild(RandomIterator root, size_t size, Comparator comp) {
+  RandomIterator LargerChild(RandomIterator root, size_t size, Comparator comp,
+                             size_t& childSize) {
     /* Get pointers to the first and second child. */
     RandomIterator first  = FirstChild(root, size);
     RandomIterator second = SecondChild(root);
 
-    /* Determine which is greater. */
-    return comp(*first, *second)? second : first;
+    /* Determine which is greater and remember the order of its tree. */
+    if (comp(*first, *second)) {
+      childSize = size - 2; // Second child is larger and has order k - 2.
+      return second;
+    } else {
+      childSize = size - 1; // First child is larger and has order k - 1.
+      return first;
+    }
+  }
+
+  /**
+   * Function: SiftIntoHole(RandomIterator hole, size_t size,
+   *                        T& value, Comparator comp);
+   * --------------------------------------------------------------------
+   * Given an iterator to the root of a Leonardo tree whose value has been
+   * moved out, leaving a hole, finds the place for value in that tree and
+   * moves it there.  Rather than swapping value down one level at a time,
+   * each larger child is moved up into the hole and the hole moves down in
+   * its place, so each level costs one move instead of the three a swap
+   * would take.
+   */
+  template <typename RandomIterator, typename T, typename Comparator>
+  void SiftIntoHole(RandomIterator hole, size_t size, T& value,
+                    Comparator comp) {
+    /* Loop until the hole has no children, which happens when the order
+     * of the tree is 0 or 1.
+     */
+    while (size > 1) {
+      /* Find the larger child. */
+      size_t childSize;
+      RandomIterator largerChild = LargerChild(hole, size, comp, childSize);
+
+      /* If the value is no smaller than this child, it goes in the hole. */
+      if (!comp(value, *largerChild))
+        break;
+
+      /* Otherwise, pull the child up and move the hole down. */
+      *hole = std::move(*largerChild);
+      hole = largerChild;
+      size = childSize;
+    }
+
+    /* Fill the hole. */
+    *hole = std::move(value);
   }
 
   /**
@@ -120,34 +255,67 @@ namespace smoothsort_detail {
    */
   template <typename RandomIterator, typename Comparator>
   void RebalanceSingleHeap(RandomIterator root, size_t size, Comparator comp) {
-    /* Loop until the current node has no children, which happens when the order
-     * of the tree is 0 or 1.
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
+    /* Trees of order 0 or 1 have no children, so they're already balanced. */
+    if (size <= 1) return;
+
+    /* If the root is bigger than its larger child, we're done. */
+    size_t childSize;
+    RandomIterator largerChild = LargerChild(root, size, comp, childSize);
+    if (!comp(*root, *largerChild))
+      return;
+
+    /* Otherwise, take the root's value out, pull the child up in its place,
+     * and sift the value down from there.
      */
-    while (size > 1) {
-      /* Get pointers to the first and second child. */
-      RandomIterator first  = FirstChild(root, size);
-      RandomIterator second = SecondChild(root);
+    T value(std::move(*root));
+    *root = std::move(*largerChild);
+    SiftIntoHole(largerChild, childSize, value, comp);
+  }
 
-      /* Determine which child is larger and remember the order of its tree. */
-      RandomIterator largerChild;
+  /**
+   * Function: bool ShouldMovePastPriorHeap(RandomIterator begin,
+   *                                        RandomIterator root,
+   *                                        const HeapShape& shape,
+   *                                        const T& value,
+   *                                        Comparator comp,
+   *                                        RandomIterator& priorHeap);
+   * ---------------------------------------------------------------------
+   * Given the root of the smallest tree in a Leonardo heap whose root value
+   * is value, returns whether the root of the tree before it must move into
+   * its place to keep the roots in sorted order.  This is the case if that
+   * prior root is strictly greater than both the value and the tree's
+   * children.  If there is a prior tree, its root is stored in priorHeap.
+   */
+  template <typename RandomIterator, typename T, typename Comparator>
+  bool ShouldMovePastPriorHeap(RandomIterator begin, RandomIterator root,
+                               const HeapShape& shape, const T& value,
+                               Comparator comp, RandomIterator& priorHeap) {
+    /* If this is the very first heap in the tree, there's nothing before it. */
+    if (size_t(std::distance(begin, root)) ==
+        kLeonardoNumbers[shape.smallestTreeSize] - 1)
+      return false;
+
+    /* In order to avoid weird edge cases when the current heap has size
+     * zero or size one, we'll compute what value will be compared against.
+     * If we aren't an order-0 or order-1 tree, we have two children, and
+     * need to check which of the three values is largest.
+     */
+    const T* toCompare = &value;
+    if (shape.smallestTreeSize > 1) {
       size_t childSize;
-      if (comp(*first, *second)) {
-        largerChild = second; // Second child is larger...
-        childSize = size - 2; // ... and has order k - 2.
-      } else {
-        largerChild = first;  // First child is larger...
-        childSize = size - 1; // ... and has order k - 1.
-      }
-
-      /* If the root is bigger than this child, we're done. */
-      if (!comp(*root, *largerChild))
-        return;
-
-      /* Otherwise, swap down and update our order. */
-      std::iter_swap(root, largerChild);
-      root = largerChild;
-      size = childSize;
+      RandomIterator largeChild = LargerChild(root, shape.smallestTreeSize,
+                                              comp, childSize);
+      if (comp(*toCompare, *largeChild))
+        toCompare = &*largeChild;
     }
+
+    /* Get a pointer to the root of the prior heap by backing up the size
+     * of this heap, and see whether it's bigger.
+     */
+    priorHeap = root - kLeonardoNumbers[shape.smallestTreeSize];
+    return comp(*toCompare, *priorHeap);
   }
 
   /**
@@ -163,79 +331,42 @@ namespace smoothsort_detail {
   template <typename RandomIterator, typename Comparator>
   void LeonardoHeapRectify(RandomIterator begin, RandomIterator end,
                            HeapShape shape, Comparator comp) {
+    typedef typename std::iterator_traits<RandomIterator>::value_type T;
+
     /* Back up the end iterator one step to get to the root of the rightmost
      * heap.
      */
     RandomIterator itr = end - 1;
 
-    /* Keep track of the size of the last heap size that we visited.  We need
-     * this so that once we've positioned the new node atop the correct heap
-     * we remember how large it is.
+    /* If the new root is already atop the correct heap, all that's left is
+     * to rebalance that heap.
      */
-    size_t lastHeapSize;
+    RandomIterator priorHeap;
+    if (!ShouldMovePastPriorHeap(begin, itr, shape, *itr, comp, priorHeap)) {
+      RebalanceSingleHeap(itr, shape.smallestTreeSize, comp);
+      return;
+    }
 
-    /* Starting at the last heap and working backward, check whether we need
-     * to swap the root of the current heap with the previous root.
+    /* Otherwise, take the new root's value out, leaving a hole.  Working
+     * backward, move the roots of earlier heaps up into the hole for as long
+     * as they are bigger, so that each step costs one move rather than a
+     * swap.  The children of each heap stay where they are, so the same
+     * comparisons decide when to stop.
      */
-    while (true) {
-      /* Cache the size of the heap we're currently on top of. */
-      lastHeapSize = shape.smallestTreeSize;
-
-      /* If this is the very first heap in the tree, we're done. */
-      if (size_t(std::distance(begin, itr)) == kLeonardoNumbers[lastHeapSize] - 1)
-        break;
-
-      /* We want to swap the previous root with this one if it's strictly
-       * greater than both the root of this tree and both its children.
-       * In order to avoid weird edge cases when the current heap has
-       * size zero or size one, we'll compute what value will be compared
-       * against.
-       */
-      RandomIterator toCompare = itr;
-
-      /* If we aren't an order-0 or order-1 tree, we have two children, and
-       * need to check which of the three values is largest.
-       */
-      if (shape.smallestTreeSize > 1) {
-        /* Get the largest child and see if we need to change what we're
-         * comparing against.
-         */
-        RandomIterator largeChild = LargerChild(itr, shape.smallestTreeSize,
-                                                comp);
-
-        /* Update what element is being compared against. */
-        if (comp(*toCompare, *largeChild))
-          toCompare = largeChild;
-      }
-
-      /* Get a pointer to the root of the second heap by backing up the size
-       * of this heap.
-       */
-      RandomIterator priorHeap = itr - kLeonardoNumbers[lastHeapSize];
-
-      /* If we ran out of trees or the new tree root is less than the element
-       * we're comparing, we now have the new node at the top of the correct
-       * heap.
-       */
-      if (!comp(*toCompare, *priorHeap))
-        break;
-
-      /* Otherwise, do the swap and adjust our location. */
-      std::iter_swap(itr, priorHeap);
+    T value(std::move(*itr));
+    do {
+      *itr = std::move(*priorHeap);
       itr = priorHeap;
 
       /* Scan down until we find the heap before this one.  We do this by
-       * continously shifting down the tree bitvector and bumping up the size
-       * of the smallest tree until we hit a new tree.
+       * shifting down the tree bitvector and bumping up the size of the
+       * smallest tree until we hit a new tree.
        */
-      do {
-        shape.trees >>= 1;
-        ++shape.smallestTreeSize;
-      } while (!shape.trees[0]);
-    }
+      SkipToNextTree(shape);
+    } while (ShouldMovePastPriorHeap(begin, itr, shape, value, comp, priorHeap));
 
-    /* Finally, rebalance the current heap. */
-    RebalanceSingleHeap(itr, lastHeapSize, comp);
+    /* Finally, sift the value down into the heap whose root it now holds. */
+    SiftIntoHole(itr, shape.smallestTreeSize, value, comp);
   }
 
   /**
@@ -266,21 +397,19 @@ namespace smoothsort_detail {
     /* Case 0 represented by the first bit being a zero; it should always be
      * one during normal operation.
      */
-    if (!shape.trees[0]) {
-      shape.trees[0] = true;
+    if (!(shape.trees & 1)) {
+      shape.trees = 1;
       shape.smallestTreeSize = 1;
     }
     /* Case 1 would be represented by the last two bits of the bitvector both
      * being set.
      */
-    else if (shape.trees[1] && shape.trees[0]) {
-      /* First, remove those two trees by shifting them off the bitvector. */
-      shape.trees >>= 2;
-
-      /* Set the last bit of the bitvector; we just added a tree of this
+    else if ((shape.trees & 3) == 3) {
+      /* First, remove those two trees by shifting them off the bitvector,
+       * then set the last bit of the bitvector; we just added a tree of this
        * size.
        */
-      shape.trees[0] = true;
+      shape.trees = (shape.trees >> 2) | 1;
 
       /* Finally, increase the size of the smallest tree by two, since the new
        * Leonardo tree has order one greater than both of them.
@@ -289,12 +418,11 @@ namespace smoothsort_detail {
     }
     /* Case two is represented by the size of the smallest tree being 1. */
     else if (shape.smallestTreeSize == 1) {
-      /* Shift the bits up one spot so that we have room for the zero bit. */
-      shape.trees <<= 1;
+      /* Shift the bits up one spot so that we have room for the zero bit,
+       * then set the bit.
+       */
+      shape.trees = (shape.trees << 1) | 1;
       shape.smallestTreeSize = 0;
-
-      /* Set the bit. */
-      shape.trees[0] = true;
     }
     /* Case three is everything else. */
     else {
@@ -302,8 +430,7 @@ namespace smoothsort_detail {
        * (W, n) for bitstring W and exponent n.  We want to convert this to
        * (W00...01, 1) by shifting up n - 1 spaces, then setting the last bit.
        */
-      shape.trees <<= shape.smallestTreeSize - 1;
-      shape.trees[0] = true;
+      shape.trees = (shape.trees << (shape.smallestTreeSize - 1)) | 1;
 
       /* Set the smallest tree size to one, since that is the new smallest
        * tree size.
@@ -330,7 +457,7 @@ namespace smoothsort_detail {
        * about to be merged.  For simplicity
        */
     case 1:
-      if (end + 1 == heapEnd || (end + 2 == heapEnd && !shape.trees[1]))
+      if (end + 1 == heapEnd || (end + 2 == heapEnd && !(shape.trees & 2)))
         isLast = true;
       break;
 
@@ -375,10 +502,7 @@ namespace smoothsort_detail {
     /* Case 1. */
     if (shape.smallestTreeSize <= 1) {
       /* Keep scanning up the list looking for the next tree. */
-      do {
-        shape.trees >>= 1;
-        ++shape.smallestTreeSize;
-      } while (shape.trees.any() && !shape.trees[0]);
+      SkipToNextTree(shape);
       return;
     }
 
@@ -387,9 +511,7 @@ namespace smoothsort_detail {
      * encoding (W011, n - 2).
      */
     const size_t heapOrder = shape.smallestTreeSize;
-    shape.trees[0] = false;
-    shape.trees <<= 2;
-    shape.trees[1] = shape.trees[0] = true;
+    shape.trees = ((shape.trees & ~uint64_t(1)) << 2) | 3;
     shape.smallestTreeSize -= 2;
 
     /* We now do the insertion-sort/rebalance operation on the larger exposed heap to
@@ -425,6 +547,7 @@ void Smoothsort(RandomIterator begin, RandomIterator end, Comparator comp) {
 
   /* Construct a shape object describing the empty heap. */
   smoothsort_detail::HeapShape shape;
+  shape.trees = 0;
   shape.smallestTreeSize = 0;
 
   /* Convert the input into an implicit Leonardo heap. */
@@ -0,0 +1,448 @@
+/**
+ * @headerfile workstealingpool.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Header file implementing a work-stealing thread pool
+ */
+
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <chrono>    // For milliseconds
+#include <condition_variable>
+#include <cstddef>   // For size_t
+#include <deque>
+#include <exception> // For exception_ptr
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Class: WorkStealingPool
+ * Usage: WorkStealingPool pool;
+ *        ParallelIntrosort(v.begin(), v.end(), std::less<int>(), pool);
+ * ---------------------------------------------------------------------------
+ * A fixed-size pool of worker threads used by the parallel sorting routines.
+ * Each worker owns a double-ended queue of tasks.  Workers push and pop tasks
+ * at the back of their own queue (so recently-spawned, cache-hot subranges are
+ * processed first) and, when they run dry, steal from the front of another
+ * worker's queue (so thieves take the oldest and therefore largest pieces of
+ * work).  Threads outside the pool can also lend a hand by calling
+ * RunPendingTask, which is how TaskGroup::Wait avoids blocking a core.
+ */
+class WorkStealingPool {
+public:
+  /* Constructor: WorkStealingPool(size_t numThreads = 0);
+   * Usage: WorkStealingPool pool(8);
+   * -------------------------------------------------------------------------
+   * Constructs a pool with the given number of worker threads.  If zero is
+   * given, one thread per hardware thread is used.
+   */
+  explicit WorkStealingPool(size_t numThreads = 0);
+
+  /* Destructor: ~WorkStealingPool();
+   * Usage: (implicit)
+   * -------------------------------------------------------------------------
+   * Stops and joins all worker threads.  Any tasks still queued are discarded,
+   * so clients should wait for their work to finish first.
+   */
+  ~WorkStealingPool();
+
+  /* void Submit(Task task);
+   * Usage: pool.Submit(task);
+   * -------------------------------------------------------------------------
+   * Enqueues a nullary function object for execution.  If called from one of
+   * the pool's workers the task goes onto that worker's own queue; otherwise
+   * the queues are filled round-robin.
+   */
+  template <typename Task> void Submit(Task task);
+
+  /* bool RunPendingTask();
+   * Usage: while (!done) if (!pool.RunPendingTask()) std::this_thread::yield();
+   * -------------------------------------------------------------------------
+   * Removes a single queued task (preferring the calling worker's own queue)
+   * and runs it on the calling thread.  Returns whether a task was run.
+   */
+  bool RunPendingTask();
+
+  /* size_t NumThreads() const;
+   * Usage: size_t numChunks = 4 * pool.NumThreads();
+   * -------------------------------------------------------------------------
+   * Returns the number of worker threads in the pool.
+   */
+  size_t NumThreads() const;
+
+private:
+  /* A single worker's task queue, guarded by its own lock. */
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque< std::function<void()> > tasks;
+  };
+
+  std::vector<WorkQueue*> queues;   // One queue per worker
+  std::vector<std::thread> workers; // The worker threads themselves
+
+  std::atomic<size_t> numQueued;    // Tasks pushed but not yet taken
+  std::atomic<size_t> nextQueue;    // Round-robin cursor for outside pushes
+  std::atomic<bool> stopping;       // Set when the pool is shutting down
+
+  std::mutex sleepLock;             // Guards sleeping workers...
+  std::condition_variable wakeUp;   // ... who wait here for new tasks.
+
+  /* Returns the index of the calling thread's queue in this pool, or the
+   * number of queues if the caller is not one of our workers.
+   */
+  size_t CurrentWorker() const;
+
+  /* Tries to take a task, first from the back of queue preferred (if it's a
+   * valid index) and then from the front of every other queue.
+   */
+  bool TakeTask(size_t preferred, std::function<void()>& task);
+
+  /* Body of each worker thread. */
+  void WorkerLoop(size_t index);
+
+  /* Records which pool and which worker the calling thread belongs to. */
+  static const WorkStealingPool*& ThreadPool();
+  static size_t& ThreadIndex();
+
+  /* Pools are neither copyable nor assignable. */
+  WorkStealingPool(const WorkStealingPool&);
+  WorkStealingPool& operator= (const WorkStealingPool&);
+};
+
+/**
+ * Class: TaskGroup<Executor>
+ * Usage: TaskGroup<WorkStealingPool> group(pool);
+ *        group.Spawn(task);
+ *        group.Wait();
+ * ---------------------------------------------------------------------------
+ * Tracks a set of tasks submitted to an executor so that a caller can wait
+ * for all of them (including any tasks they spawn into the same group) to
+ * finish.  Waiting threads execute pending tasks rather than sleeping, and
+ * only go to sleep once there has been nothing left for them to run for a
+ * while.  If any task throws, the first exception is rethrown from Wait.
+ *
+ * Executor must provide Submit(Task), RunPendingTask(), and NumThreads()
+ * with the semantics of the member functions of WorkStealingPool.  The
+ * parallel sorts use NumThreads() to decide how finely to split their work.
+ */
+template <typename Executor> class TaskGroup {
+public:
+  /* Constructor: TaskGroup(Executor& executor);
+   * Usage: TaskGroup<WorkStealingPool> group(pool);
+   * -------------------------------------------------------------------------
+   * Constructs an empty task group that submits work to the given executor.
+   */
+  explicit TaskGroup(Executor& executor);
+
+  /* Destructor: ~TaskGroup();
+   * Usage: (implicit)
+   * -------------------------------------------------------------------------
+   * Waits for every task spawned into this group to finish, since they may
+   * refer to the group and to whatever the caller gave them.  This matters
+   * when the caller leaves through an exception before calling Wait.  Any
+   * exception the tasks raised is discarded.
+   */
+  ~TaskGroup();
+
+  /* void Spawn(Task task);
+   * Usage: group.Spawn(task);
+   * -------------------------------------------------------------------------
+   * Submits a nullary function object to the executor as part of this group.
+   */
+  template <typename Task> void Spawn(Task task);
+
+  /* void Wait();
+   * Usage: group.Wait();
+   * -------------------------------------------------------------------------
+   * Runs pending tasks on the calling thread until every task spawned into
+   * this group has finished, then rethrows the first exception (if any) that
+   * one of those tasks raised.
+   */
+  void Wait();
+
+  /* Executor& GetExecutor() const;
+   * Usage: pool.NumThreads() == group.GetExecutor().NumThreads();
+   * -------------------------------------------------------------------------
+   * Returns the executor this group submits its tasks to.
+   */
+  Executor& GetExecutor() const;
+
+private:
+  /* A wrapper around a client task that reports completion to the group. */
+  template <typename Task> struct Job {
+    TaskGroup* group;
+    Task task;
+
+    void operator() () {
+      try {
+        task();
+      } catch (...) {
+        group->RecordException(std::current_exception());
+      }
+      group->FinishTask();
+    }
+  };
+
+  /* Stores the given exception if it is the first one seen. */
+  void RecordException(std::exception_ptr error);
+
+  /* Marks one task as finished, waking any waiters if it was the last. */
+  void FinishTask();
+
+  /* Runs pending tasks until every task in this group has finished. */
+  void WaitForPending();
+
+  Executor& executor;               // Where tasks run
+  std::atomic<size_t> numPending;   // Tasks spawned but not yet finished
+  std::mutex errorLock;             // Guards firstError
+  std::exception_ptr firstError;    // First exception thrown by a task
+  std::mutex doneLock;              // Guards decrements of numPending...
+  std::condition_variable done;     // ... and announces when it hits zero.
+
+  /* Task groups are neither copyable nor assignable. */
+  TaskGroup(const TaskGroup&);
+  TaskGroup& operator= (const TaskGroup&);
+};
+
+/* * * * * Implementation Below This Point * * * * */
+
+inline WorkStealingPool::WorkStealingPool(size_t numThreads)
+  : numQueued(0), nextQueue(0), stopping(false) {
+  /* Default to one worker per hardware thread, remembering that
+   * hardware_concurrency is allowed to report zero.
+   */
+  if (numThreads == 0)
+    numThreads = std::thread::hardware_concurrency();
+  if (numThreads == 0)
+    numThreads = 1;
+
+  /* Build all of the queues before starting any worker, since workers steal
+   * from one another right away.
+   */
+  for (size_t i = 0; i < numThreads; ++i)
+    queues.push_back(new WorkQueue);
+  for (size_t i = 0; i < numThreads; ++i)
+    workers.push_back(std::thread(&WorkStealingPool::WorkerLoop, this, i));
+}
+
+inline WorkStealingPool::~WorkStealingPool() {
+  /* Flag the shutdown while holding the sleep lock so that no worker can
+   * miss the wakeup between checking the flag and going to sleep.
+   */
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    stopping.store(true);
+  }
+  wakeUp.notify_all();
+
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  for (size_t i = 0; i < queues.size(); ++i)
+    delete queues[i];
+}
+
+template <typename Task>
+void WorkStealingPool::Submit(Task task) {
+  /* Workers keep their own spawned tasks local; everyone else spreads their
+   * tasks across the queues.
+   */
+  size_t index = CurrentWorker();
+  if (index == queues.size())
+    index = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+  {
+    std::lock_guard<std::mutex> guard(queues[index]->lock);
+    queues[index]->tasks.push_back(std::function<void()>(task));
+  }
+
+  /* Publish the new task and wake a sleeping worker, if any.  Taking the
+   * sleep lock orders this against a worker that is about to sleep.
+   */
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    numQueued.fetch_add(1, std::memory_order_release);
+  }
+  wakeUp.notify_one();
+}
+
+inline bool WorkStealingPool::RunPendingTask() {
+  std::function<void()> task;
+  if (!TakeTask(CurrentWorker(), task))
+    return false;
+
+  task();
+  return true;
+}
+
+inline size_t WorkStealingPool::NumThreads() const {
+  return workers.size();
+}
+
+inline const WorkStealingPool*& WorkStealingPool::ThreadPool() {
+  static thread_local const WorkStealingPool* pool = NULL;
+  return pool;
+}
+
+inline size_t& WorkStealingPool::ThreadIndex() {
+  static thread_local size_t index = 0;
+  return index;
+}
+
+inline size_t WorkStealingPool::CurrentWorker() const {
+  return ThreadPool() == this? ThreadIndex() : queues.size();
+}
+
+inline bool WorkStealingPool::TakeTask(size_t preferred,
+                                       std::function<void()>& task) {
+  const size_t numQueues = queues.size();
+
+  /* Our own queue is treated as a stack, so we get the newest task. */
+  if (preferred < numQueues) {
+    WorkQueue& queue = *queues[preferred];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (!queue.tasks.empty()) {
+      task.swap(queue.tasks.back());
+      queue.tasks.pop_back();
+      numQueued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  /* Otherwise, steal the oldest task from someone else, starting just after
+   * our own queue so that thieves spread out over the victims.
+   */
+  const size_t start = preferred < numQueues? preferred + 1 : 0;
+  for (size_t i = 0; i < numQueues; ++i) {
+    WorkQueue& queue = *queues[(start + i) % numQueues];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (!queue.tasks.empty()) {
+      task.swap(queue.tasks.front());
+      queue.tasks.pop_front();
+      numQueued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+inline void WorkStealingPool::WorkerLoop(size_t index) {
+  ThreadPool() = this;
+  ThreadIndex() = index;
+
+  std::function<void()> task;
+  while (true) {
+    /* Run tasks for as long as we can find them. */
+    if (TakeTask(index, task)) {
+      task();
+      task = std::function<void()>();
+      continue;
+    }
+
+    /* Nothing to do; sleep until there is something queued or we're told to
+     * stop.
+     */
+    std::unique_lock<std::mutex> guard(sleepLock);
+    while (!stopping.load() && numQueued.load(std::memory_order_acquire) == 0)
+      wakeUp.wait(guard);
+    if (stopping.load())
+      return;
+  }
+}
+
+template <typename Executor>
+TaskGroup<Executor>::TaskGroup(Executor& executor)
+  : executor(executor), numPending(0) {
+  // Handled in initializer list
+}
+
+template <typename Executor>
+TaskGroup<Executor>::~TaskGroup() {
+  WaitForPending();
+}
+
+template <typename Executor>
+template <typename Task>
+void TaskGroup<Executor>::Spawn(Task task) {
+  /* Count the task before submitting it so that Wait can never observe the
+   * group as finished while the task is still in flight.
+   */
+  numPending.fetch_add(1, std::memory_order_relaxed);
+
+  Job<Task> job = { this, task };
+  executor.Submit(job);
+}
+
+template <typename Executor>
+void TaskGroup<Executor>::Wait() {
+  WaitForPending();
+
+  /* Report any failure, clearing it so the group can be reused. */
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> guard(errorLock);
+    error.swap(firstError);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+template <typename Executor>
+Executor& TaskGroup<Executor>::GetExecutor() const {
+  return executor;
+}
+
+template <typename Executor>
+void TaskGroup<Executor>::RecordException(std::exception_ptr error) {
+  std::lock_guard<std::mutex> guard(errorLock);
+  if (!firstError)
+    firstError = error;
+}
+
+template <typename Executor>
+void TaskGroup<Executor>::FinishTask() {
+  /* The count is decremented under the lock so that a waiter can't see it
+   * reach zero and destroy the group while we're still announcing it.
+   */
+  std::lock_guard<std::mutex> guard(doneLock);
+  if (numPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    done.notify_all();
+}
+
+template <typename Executor>
+void TaskGroup<Executor>::WaitForPending() {
+  /* Constants controlling how long we look for work before sleeping.  A
+   * waiter that finds nothing to run yields a few times in case more work
+   * is about to be spawned, then sleeps until the group finishes.  It still
+   * wakes up now and then to look for work, since tasks may spawn more
+   * tasks into the group while it sleeps.
+   */
+  const size_t kIdleSpins = 64;
+  const std::chrono::milliseconds kSleepTime(1);
+
+  size_t idleSpins = 0;
+  while (numPending.load(std::memory_order_acquire) != 0) {
+    /* Help out with whatever work is queued until our own work is done. */
+    if (executor.RunPendingTask()) {
+      idleSpins = 0;
+    } else if (++idleSpins < kIdleSpins) {
+      std::this_thread::yield();
+    } else {
+      std::unique_lock<std::mutex> lock(doneLock);
+      if (numPending.load(std::memory_order_acquire) != 0)
+        done.wait_for(lock, kSleepTime);
+      idleSpins = 0;
+    }
+  }
+
+  /* The last task may have decremented the count but not yet released the
+   * lock, so wait for it before letting the caller destroy the group.
+   */
+  std::lock_guard<std::mutex> guard(doneLock);
+}
+
+#endif // WORKSTEALINGPOOL_H